@@ -1,6 +1,6 @@
 /* 
 	Copyright 2010 OpenRTMFP
-
+ 
 	This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
     the Free Software Foundation, either version 3 of the License, or
@@ -19,11 +19,17 @@
 
 #include "Cumulus.h"
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 
 namespace Cumulus {
 
 #define AES_KEY_SIZE 0x20
 
+// AES-128-CBC with a null IV on each packet.
+// The EVP type keeps an OpenSSL cipher context by engine (so by session direction) where the key is expanded once,
+// and EVP uses AES-NI when the CPU has it. The LEGACY type is the old AES_cbc_encrypt path.
+// An EVP engine must not be used by several threads in the same time (its context changes on each process),
+// a LEGACY engine can be.
 class AESEngine
 {
 public:
@@ -31,16 +37,49 @@ public:
 		DECRYPT=0,
 		ENCRYPT
 	};
-	AESEngine(const Poco::UInt8* key,Direction direction);
+	enum Type {
+		LEGACY=0,
+		EVP
+	};
+	AESEngine(const Poco::UInt8* key,Direction direction,Type type=Default());
+	AESEngine(const AESEngine& other);
 	virtual ~AESEngine();
 
 	void process(const Poco::UInt8* in,Poco::UInt8* out,unsigned int size);
+	// Continues a CBC chain from 'iv' and leaves in 'iv' the IV of the next blocks,
+	// so a packet can be processed by parts (each part but the last one must be a multiple of AES_BLOCK_SIZE)
+	void process(const Poco::UInt8* in,Poco::UInt8* out,unsigned int size,Poco::UInt8* iv);
+
+	Type type() const;
+
+	// Type of the new engines: EVP if the CPU has AES-NI (or isn't a x86 one, EVP knows the best way), LEGACY otherwise
+	static Type		Default();
+	static void		SetDefault(Type type);
+	static bool		HasAESNI();
 
 private:
-	Direction	_direction;
-	AES_KEY		_key;
+	AESEngine& operator=(const AESEngine& other);
+
+	Direction			_direction;
+	Type				_type;
+	AES_KEY				_key;
+	EVP_CIPHER_CTX*		_pContext;
+
+	static Type			s_default;
 };
 
+inline AESEngine::Type AESEngine::type() const {
+	return _type;
+}
+
+inline AESEngine::Type AESEngine::Default() {
+	return s_default;
+}
+
+inline void AESEngine::SetDefault(Type type) {
+	s_default = type;
+}
+
 
 
 } // namespace Cumulus
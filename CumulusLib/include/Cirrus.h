@@ -29,15 +29,19 @@ class Middle;
 class Cirrus
 {
 public:
-	Cirrus(const Poco::Net::SocketAddress& address,Sessions& sessions);
+	Cirrus(const Poco::Net::SocketAddress& address);
 	virtual ~Cirrus();
 
 	const Middle*					findMiddle(const Poco::UInt8* peerId);
 	const Poco::Net::SocketAddress&	address();
 
+	// Index of the middle sessions (of all the workers) by middle peer id
+	void							addMiddle(Middle& middle);
+	void							removeMiddle(Middle& middle);
+
 private:
-	Sessions&					_sessions;
-	Poco::Net::SocketAddress	_address;
+	Poco::Net::SocketAddress				_address;
+	HashIndex<PeerIdKey,const Middle*>		_middles;
 };
 
 inline const Poco::Net::SocketAddress& Cirrus::address() {
@@ -45,6 +45,9 @@ public:
 	const Poco::URI								swfUrl;
 	const Poco::URI								pageUrl;
 	const ClientState							state;
+	// Smoothed round-trip time and its variance, in RTMFP time unit (4 ms)
+	const Poco::UInt16							ping;
+	const Poco::UInt16							pingVariance;
 
 	std::vector<Poco::UInt8>					data;
 
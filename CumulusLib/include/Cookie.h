@@ -18,19 +18,129 @@
 #pragma once
 
 #include "Cumulus.h"
-
+#include "HashIndex.h"
+#include "Poco/Timestamp.h"
+#include <vector>
+#include <deque>
 
 namespace Cumulus {
 
+#define COOKIE_SIZE		0x40
+#define COOKIE_TIMEOUT	30000000 // 30 sec to finish the handshake
+#define COOKIE_STATELESS_TIMEOUT	10000000 // 10 sec, a stateless cookie is valid only during the retransmissions of its 0x38 request
+#define COOKIE_SIGNATURE_SIZE		0x20
+#ifndef COOKIE_CAPACITY
+	#define COOKIE_CAPACITY	4096
+#endif
 
 class Cookie {
 public:
-	Cookie(const std::string& queryUrl);
+	Cookie();
 	virtual ~Cookie();
 
-	const std::string queryUrl;
+	Poco::UInt8					value[COOKIE_SIZE];
+	std::string					queryUrl;
+	Poco::Timestamp::TimeVal	created;
+	bool						used;
+	bool						consumed; // by a session creation, kept to answer the retransmissions
+};
+
+// Key of the index of cookies (64 random bytes)
+class CookieKey {
+public:
+	CookieKey();
+	CookieKey(const Poco::UInt8* value);
+
+	Poco::UInt32	hash() const;
+	bool			operator==(const CookieKey& other) const;
+private:
+	Poco::UInt8		_value[COOKIE_SIZE];
+	Poco::UInt32	_hash;
+};
+
+// Cookies in waiting of session creation, in a ring of fixed capacity ordered by creation time:
+// the oldest cookie is replaced when the ring is full, and the expired cookies are removed from the oldest.
+// So a flood of 0x30 handshakes can't grow the memory.
+class Cookies {
+public:
+	Cookies(Poco::UInt32 capacity=COOKIE_CAPACITY);
+	virtual ~Cookies();
+
+	Cookie*				find(const Poco::UInt8* value) const;
+	// Returns the cookie already added if the value is a duplicate
+	const Cookie&		add(const Poco::UInt8* value,const std::string& queryUrl,Poco::Timestamp::TimeVal now);
+	void				remove(Cookie& cookie);
+	// Removes the cookies created before now-COOKIE_TIMEOUT
+	void				expire(Poco::Timestamp::TimeVal now);
+	void				clear();
+
+	Poco::UInt32		count() const;
+
+private:
+	void				pop();
+
+	std::vector<Cookie>				_cookies;
+	Poco::UInt32					_oldest;
+	Poco::UInt32					_count; // including the holes of the cookies removed
+	Poco::UInt32					_used;
+	HashIndex<CookieKey,Cookie*>	_index;
+};
+
+inline Poco::UInt32 Cookies::count() const {
+	return _used;
+}
+
+inline Cookie* Cookies::find(const Poco::UInt8* value) const {
+	return _index.find(CookieKey(value));
+}
+
+// Key of the index of the consumed stateless cookies (their HMAC-SHA256 signature)
+class SignatureKey {
+public:
+	SignatureKey();
+	SignatureKey(const Poco::UInt8* signature);
 
+	Poco::UInt32	hash() const;
+	bool			operator==(const SignatureKey& other) const;
+private:
+	Poco::UInt8		_value[COOKIE_SIGNATURE_SIZE];
+	Poco::UInt32	_hash;
 };
 
+// Signatures of the stateless cookies consumed by a session creation, to refuse their replay.
+// Each one is kept until its cookie expires, then the age of the cookie refuses it: no signature is forgotten before,
+// and the set is bounded by the sessions created during COOKIE_STATELESS_TIMEOUT.
+class ConsumedCookies {
+public:
+	ConsumedCookies();
+	virtual ~ConsumedCookies();
+
+	bool				find(const Poco::UInt8* signature) const;
+	void				add(const Poco::UInt8* signature,Poco::Timestamp::TimeVal expiration);
+	// Removes the signatures of the cookies expired at now
+	void				expire(Poco::Timestamp::TimeVal now);
+	void				clear();
+
+	Poco::UInt32		count() const;
+
+private:
+	struct Consumed {
+		Consumed(const Poco::UInt8* signature,Poco::Timestamp::TimeVal expiration) : key(signature),expiration(expiration) {}
+		SignatureKey				key;
+		Poco::Timestamp::TimeVal	expiration;
+	};
+
+	std::deque<Consumed>				_consumed; // by consumption order
+	HashIndex<SignatureKey,bool>		_index;
+};
+
+inline Poco::UInt32 ConsumedCookies::count() const {
+	return _consumed.size();
+}
+
+inline bool ConsumedCookies::find(const Poco::UInt8* signature) const {
+	return _index.find(SignatureKey(signature));
+}
+
 
 } // namespace Cumulus
@@ -0,0 +1,60 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+#include "Poco/Event.h"
+#include <deque>
+#include <vector>
+
+namespace Cumulus {
+
+class CryptoJob {
+public:
+	CryptoJob() {}
+	virtual ~CryptoJob() {}
+	// Called by a thread of the pool
+	virtual void process()=0;
+};
+
+// Threads which process in parallel the cryptographic jobs pushed by the workers
+class CryptoPool : private Poco::Runnable {
+public:
+	CryptoPool(Poco::UInt8 threads);
+	virtual ~CryptoPool();
+
+	// Thread-safe
+	void			push(CryptoJob* pJob);
+	// Stops the threads, the jobs not processed are forgotten (they are still owned by their creator)
+	void			stop();
+
+private:
+	void			run();
+
+	volatile bool				_terminate;
+	Poco::FastMutex				_mutex;
+	Poco::Event					_event;
+	std::deque<CryptoJob*>		_jobs;
+	std::vector<Poco::Thread*>	_threads;
+};
+
+
+} // namespace Cumulus
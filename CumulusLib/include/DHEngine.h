@@ -0,0 +1,56 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include <openssl/bn.h>
+
+namespace Cumulus {
+
+#define DH_KEY_SIZE 0x80
+
+// Diffie-Hellman of the RTMFP group (1024 bits prime of RFC 2409, generator 2).
+// The group is precomputed once and shared by all the engines (read only, so by all the threads):
+// its Montgomery context, and for the key generation a table of the powers of 2 by window of 4 bits of the exponent,
+// the table entry of each window is read in constant time.
+// An engine is a keypair generated at its construction.
+class DHEngine
+{
+public:
+	DHEngine();
+	virtual ~DHEngine();
+
+	// Big endian, DH_KEY_SIZE bytes
+	const Poco::UInt8*	publicKey() const;
+	// Writes DH_KEY_SIZE bytes, returns false if the far public key isn't valid
+	bool				computeSecret(const Poco::UInt8* farPubKey,Poco::UInt8* sharedSecret) const;
+
+private:
+	DHEngine(const DHEngine& other);
+	DHEngine& operator=(const DHEngine& other);
+
+	BIGNUM*			_pPrivateKey;
+	Poco::UInt8		_publicKey[DH_KEY_SIZE];
+};
+
+inline const Poco::UInt8* DHEngine::publicKey() const {
+	return _publicKey;
+}
+
+
+} // namespace Cumulus
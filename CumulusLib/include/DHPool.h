@@ -0,0 +1,69 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Mutex.h"
+#include "Poco/Event.h"
+#include "DHEngine.h"
+#include <deque>
+#include <vector>
+
+namespace Cumulus {
+
+class CUMULUS_API DHPoolStats {
+public:
+	DHPoolStats() : ready(0),depth(0),acquired(0),misses(0) {
+	}
+	Poco::UInt32	ready; // keypairs in the pool
+	Poco::UInt16	depth;
+	Poco::UInt32	acquired; // handshakes served
+	Poco::UInt32	misses; // handshakes which have found the pool empty
+};
+
+// Diffie-Hellman keypairs of the RTMFP group generated in advance by background threads,
+// so a handshake pays only the computation of the shared secret
+class DHPool : private Poco::Runnable {
+public:
+	DHPool(Poco::UInt16 depth,Poco::UInt8 threads=1);
+	virtual ~DHPool();
+
+	// Thread-safe, same contract as RTMFP::BeginDiffieHellman: gives a keypair ready (or generated now if the pool is empty)
+	DHEngine*		acquire(Poco::UInt8* pubKey);
+	void			stop();
+
+	// Metrics, thread-safe
+	void			stats(DHPoolStats& stats);
+
+private:
+	void			run();
+
+	const Poco::UInt16			_depth;
+	volatile bool				_terminate;
+	Poco::FastMutex				_mutex;
+	Poco::Event					_event;
+	std::deque<DHEngine*>		_keyPairs;
+	std::vector<Poco::Thread*>	_threads;
+	Poco::UInt32				_acquired;
+	Poco::UInt32				_misses;
+};
+
+
+} // namespace Cumulus
@@ -0,0 +1,145 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "PacketReader.h"
+#include "PacketWriter.h"
+#include "PacketPool.h"
+#include "Poco/Timespan.h"
+#include "Poco/Net/DatagramSocket.h"
+#include <vector>
+
+#define DATAGRAM_MAX_BATCH		256
+#define DATAGRAM_URING_BATCH	64
+
+struct mmsghdr;
+struct msghdr;
+struct iovec;
+struct sockaddr_storage;
+
+namespace Cumulus {
+
+class IOUring;
+
+// Receive and send the datagrams of the main socket.
+// In batch mode (recvmmsg/sendmmsg, linux only) several datagrams are received by one system call,
+// and the sendings are queued to be sent together on flush().
+// In ring mode (io_uring, linux only) a multishot recvmsg fills a ring of buffers provided to the kernel,
+// and the sendings of a flush() are submitted by one system call without waiting their completions: the sending buffers
+// are in two halves, one is filled while the other is in the kernel. It falls back in batch mode if the kernel can't.
+// Otherwise it's the classic path: one receiveFrom and one sendTo by datagram.
+class DatagramEngine {
+public:
+	DatagramEngine(Poco::Net::DatagramSocket& socket,PacketPool& pool);
+	virtual ~DatagramEngine();
+
+	void			open(Poco::UInt16 batchSize=0,bool uring=false);
+	void			close();
+	bool			batched() const;
+	bool			ring() const;
+	// Descriptor to watch in ring mode (readable when receptions are completed)
+	int				ringFd() const;
+
+	// Wait the timeout and returns the number of datagrams received (0 on timeout)
+	int								receive(const Poco::Timespan& timeout);
+	// Socket readable, returns the number of datagrams received without waiting
+	int								receive();
+	Poco::UInt8*					packet(int index);
+	// Takes the ownership of the buffer of a datagram received (one reference), to keep it after the next reception
+	PacketBuffer*					take(int index);
+	int								size(int index) const;
+	const Poco::Net::SocketAddress&	sender(int index) const;
+
+	void			send(const Poco::UInt8* data,int size,const Poco::Net::SocketAddress& address);
+	void			flush();
+
+	PacketPool&		pool();
+
+private:
+	void			slots(Poco::UInt16 count);
+
+	int				receiveBatch();
+	int				receiveClassic();
+	void			sendClassic(const Poco::UInt8* data,int size,const Poco::Net::SocketAddress& address);
+
+	bool			openRing();
+	void			closeRing();
+	void			armRing();
+	int				receiveRing();
+	void			flushRing();
+	// Releases the sending completions arrived, and waits the last ones of the half 'wait' (0 or 1) if given
+	void			reapRing(int wait=-1);
+
+	Poco::Net::DatagramSocket&				_socket;
+	PacketPool&								_pool;
+	Poco::UInt16							_batchSize;
+
+	// Receiving, the datagrams are received in buffers of the pool (except in ring mode)
+	std::vector<PacketBuffer*>				_slots;
+	std::vector<Poco::UInt8*>				_packets;
+	std::vector<int>						_sizes;
+	std::vector<Poco::Net::SocketAddress>	_senders;
+	struct mmsghdr*							_pRecvMsgs;
+	struct iovec*							_pRecvVecs;
+	struct sockaddr_storage*				_pRecvAddresses;
+
+	// Sending, two halves of _batchSize datagrams in ring mode, _sendFirst is the first one of the half in filling
+	Poco::UInt8*							_sendBuffers;
+	Poco::UInt16							_sendFirst;
+	Poco::UInt16							_sendCount;
+	Poco::UInt16							_sendPending[2];
+	struct mmsghdr*							_pSendMsgs;
+	struct iovec*							_pSendVecs;
+	struct sockaddr_storage*				_pSendAddresses;
+
+	// Ring mode
+	IOUring*								_pRecvRing;
+	IOUring*								_pSendRing;
+	Poco::UInt8*							_ringBuffers;
+	std::vector<Poco::UInt16>				_ringUsed;
+	bool									_ringArmed;
+	struct msghdr*							_pRingMsg;
+};
+
+inline bool DatagramEngine::batched() const {
+	return _batchSize>1;
+}
+
+inline bool DatagramEngine::ring() const {
+	return _pRecvRing!=NULL;
+}
+
+inline Poco::UInt8* DatagramEngine::packet(int index) {
+	return _packets[index];
+}
+
+inline PacketPool& DatagramEngine::pool() {
+	return _pool;
+}
+
+inline int DatagramEngine::size(int index) const {
+	return _sizes[index];
+}
+
+inline const Poco::Net::SocketAddress& DatagramEngine::sender(int index) const {
+	return _senders[index];
+}
+
+
+} // namespace Cumulus
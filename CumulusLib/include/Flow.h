@@ -49,6 +49,7 @@ public:
 	bool consumed();
 	void fail();
 	void raise();
+	bool repeating() const; // messages are waiting an acknowledgment
 	virtual void complete();
 
 	Poco::UInt32		stageRcv();
@@ -101,6 +102,10 @@ private:
 	Message					_messageNull;
 };
 
+inline bool Flow::repeating() const {
+	return _trigger.running();
+}
+
 inline Poco::UInt32 Flow::stageRcv() {
 	return _stageRcv;
 }
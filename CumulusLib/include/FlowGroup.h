@@ -37,7 +37,8 @@ private:
 	void rawHandler(Poco::UInt8 type,PacketReader& data);
 
 	std::list<const Peer*>		_bestPeers;
-	Group*						_pGroup;
+	// id rather than pointer, the group is deleted as soon as it becomes empty
+	std::vector<Poco::UInt8>	_groupId;
 };
 
 } // namespace Cumulus
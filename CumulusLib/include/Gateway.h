@@ -23,6 +23,7 @@
 
 namespace Cumulus {
 
+class KeyExchange;
 
 class Gateway
 {
@@ -32,6 +33,8 @@ public:
 
 	virtual Poco::UInt8 p2pHandshake(const std::string& tag,PacketWriter& response,const Poco::Net::SocketAddress& address,const Poco::UInt8* peerIdWanted)=0;
 	virtual Poco::UInt32 createSession(Poco::UInt32 farId,const Peer& peer,const Poco::UInt8* decryptKey,const Poco::UInt8* encryptKey)=0;
+	// Called by a crypto thread when an asynchronous key exchange is done
+	virtual void keyExchanged(KeyExchange* pKeyExchange)=0;
 };
 
 
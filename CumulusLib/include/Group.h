@@ -24,11 +24,24 @@
 
 namespace Cumulus {
 
+// Key of the group registry: the group id bytes
+class GroupKey {
+public:
+	GroupKey();
+	GroupKey(const std::vector<Poco::UInt8>& id);
+
+	Poco::UInt32	hash() const;
+	bool			operator==(const GroupKey& other) const;
+private:
+	std::vector<Poco::UInt8>	_id;
+	Poco::UInt32				_hash;
+};
 
+class ServerHandler;
 class Group {
 	friend class Peer;
 public:
-	Group(const std::vector<Poco::UInt8>& id);
+	Group(const std::vector<Poco::UInt8>& id,ServerHandler& handler);
 	virtual ~Group();
 
 	bool operator==(const Group& other) const;
@@ -36,21 +49,34 @@ public:
 	bool operator!=(const Group& other) const;
 	bool operator!=(const std::vector<Poco::UInt8>& id) const;
 
+	const std::vector<Poco::UInt8>& id() const;
+
 	void addPeer(Peer& peer);
+	// When the last peer leaves, the group is deleted by the server handler
 	void removePeer(Peer& peer);
 	//void clear();
 	void bestPeers(std::list<const Peer*>& peers,const Peer& askerPeer);
+	void introductions(IntroductionStats& stats) const;
 	bool empty();
 
 private:
 	std::vector<Poco::UInt8>	_id;
 	Peers						_peers;
+	ServerHandler&				_handler;
 };
 
+inline const std::vector<Poco::UInt8>& Group::id() const {
+	return _id;
+}
+
 inline bool Group::empty() {
 	return _peers.empty();
 }
 
+inline void Group::introductions(IntroductionStats& stats) const {
+	_peers.introductions(stats);
+}
+
 inline void Group::bestPeers(std::list<const Peer*>& peers,const Peer& askerPeer) {
 	_peers.best(peers,askerPeer);
 }
@@ -20,28 +20,104 @@
 #include "Cumulus.h"
 #include "Session.h"
 #include "Cookie.h"
+#include "ResponseCache.h"
 #include "Gateway.h"
+#include "DHPool.h"
+#include "CryptoPool.h"
+#include "LockFreeQueue.h"
+#include "AESEngine.h"
+#include <set>
 
 namespace Cumulus {
 
+// Diffie-Hellman exchange and computation of the session keys of a 0x38 handshake,
+// done by a thread of the crypto pool if there is one
+class KeyExchange : public CryptoJob,public QueueNode {
+public:
+	KeyExchange(Gateway& gateway,DHPool* pDHPool,const std::string& cookie,Poco::UInt32 farId,const Poco::Net::SocketAddress& address);
+	void process();
+	// Synchronous computation
+	void compute(const std::string& signature);
+
+	const std::string				cookie;
+	const Poco::UInt32				farId;
+	const Poco::Net::SocketAddress	address;
+
+	// Request
+	std::string						signature;
+	std::string						farSignature;
+	std::string						farCertificat;
+	Poco::UInt8						farPubKey[DH_KEY_SIZE];
+
+	// Results
+	Poco::UInt8						peerId[32];
+	Poco::UInt8						pubKey[DH_KEY_SIZE];
+	Poco::UInt8						requestKey[AES_KEY_SIZE];
+	Poco::UInt8						responseKey[AES_KEY_SIZE];
+	bool							exchanged; // false if the far public key is invalid, no session then
+
+private:
+	Gateway&						_gateway;
+	DHPool*							_pDHPool;
+};
 
 class Handshake : public Session {
 public:
-	Handshake(Gateway& gateway,Poco::Net::DatagramSocket& socket,ServerHandler& serverHandler);
+	Handshake(Gateway& gateway,DatagramEngine& engine,ServerHandler& serverHandler,const Poco::UInt8* certificat,DHPool* pDHPool=NULL,CryptoPool* pCryptoPool=NULL,bool statelessCookies=false);
 	~Handshake();
 	
 	void clear();
+	// Called on each tick of the loop, expires the cookies and the cached responses
+	void manage();
+	// Asynchronous key exchange done, creates the session and sends the 0x78 response (in the packet loop thread)
+	void keyExchanged(KeyExchange* pKeyExchange);
+	// Hole punching done by the worker of the wanted session, sends the 0x71 response (in the packet loop thread)
+	void p2pHandshaked(const std::string& tag,const Poco::Net::SocketAddress& address,const Peer& peerWanted);
+
+	// Addresses of the wanted peer in a 0x71 response to the peer at 'address'
+	static void WriteAddresses(PacketWriter& response,const Peer& peerWanted,const Poco::Net::SocketAddress& address);
 private:
 	void		packetHandler(PacketReader& packet);
 	Poco::UInt8	handshakeHandler(Poco::UInt8 id,PacketReader& request,PacketWriter& response);
+	Poco::UInt8	keyExchangeHandler(const KeyExchange& keyExchange,const std::string& queryUrl,PacketWriter& response);
+	void		send(Poco::UInt8 idResponse);
+	// Retransmitted request: writes its cached response and returns its id (0 if not cached)
+	// The responses are cached by key and address of the sender, to answer only the retransmissions of this one
+	Poco::UInt8	cachedResponse(const ResponseCache& cache,const std::string& key,const Poco::Net::SocketAddress& address,PacketWriter& response);
+	void		cacheResponse(ResponseCache& cache,const std::string& key,const Poco::Net::SocketAddress& address,Poco::UInt8 idResponse,PacketWriter& response,int start);
+	// Host (padded to 16 bytes) and port of the address, 18 bytes
+	static void	WriteAddress(const Poco::Net::SocketAddress& address,Poco::UInt8* data);
+	// Writes the key and the address in value (RESPONSE_KEY_SIZE bytes), returns the size written
+	static Poco::UInt8 ResponseKeyOf(const std::string& key,const Poco::Net::SocketAddress& address,Poco::UInt8* value);
+
+	// Stateless cookie: creation time (4 bytes, in seconds), random (12), SHA256 of the epd (16 first bytes),
+	// and HMAC-SHA256 of these 32 bytes and of the client address with the secret of the handshake (32)
+	void		createCookie(const std::string& epd,Poco::UInt8* cookie);
+	bool		checkCookie(const Poco::UInt8* cookie);
+	// Time from which a stateless cookie is refused, COOKIE_STATELESS_TIMEOUT after its creation
+	static Poco::Timestamp::TimeVal CookieExpiration(const Poco::UInt8* cookie);
+	void		signCookie(const Poco::UInt8* cookie,const Poco::Net::SocketAddress& address,Poco::UInt8* signature);
 
-	// Cookie, in waiting of creation session
-	std::map<std::string,Cookie*> _cookies;
+	// Cookies in waiting of session creation, then consumed until their expiration (not used with the stateless cookies)
+	Cookies							_cookies;
+	// Stateless cookies consumed by a session creation, until their expiration
+	ConsumedCookies					_consumedCookies;
+	const bool						_statelessCookies;
+	Poco::UInt8						_cookieSecret[32];
+	Poco::Timestamp::TimeVal		_now; // time of the last tick of the loop
+	// Key exchanges in progress by cookie, the retransmissions of their 0x38 requests are ignored.
+	// They are deleted only by the destructor, after the stop of the crypto pool
+	std::map<std::string,KeyExchange*> _keyExchanges;
+	// Responses 0x70 by tag and 0x78 by cookie (with the sender address), the retransmissions are answered without new cookie, key exchange or session
+	ResponseCache					_cookieResponses;
+	ResponseCache					_sessionResponses;
 
 	Poco::UInt8		_certificat[77];
 	std::string		_signature;
 
 	Gateway&		_gateway;
+	DHPool*			_pDHPool;
+	CryptoPool*		_pCryptoPool;
 };
 
 
@@ -0,0 +1,133 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include <vector>
+
+namespace Cumulus {
+
+// Hash index in open addressing (linear probing, deletion by backward shift) to find a value by its key in O(1).
+// Key must have a 'Poco::UInt32 hash() const' method and an equality operator,
+// Value must be a small type (typically a pointer) whose the default value means "not found".
+// The capacity is a power of 2, doubled when the load passes 3/4.
+template<typename Key,typename Value>
+class HashIndex {
+public:
+	HashIndex() : _count(0) {}
+
+	Value find(const Key& key) const {
+		if(_count==0)
+			return Value();
+		Poco::UInt32 mask = _entries.size()-1;
+		Poco::UInt32 i = key.hash()&mask;
+		while(_entries[i].used) {
+			if(_entries[i].key==key)
+				return _entries[i].value;
+			i = (i+1)&mask;
+		}
+		return Value();
+	}
+
+	// Inserts or replaces the value of the key
+	void set(const Key& key,const Value& value) {
+		if((_count+1)*4 > _entries.size()*3)
+			grow();
+		Poco::UInt32 mask = _entries.size()-1;
+		Poco::UInt32 i = key.hash()&mask;
+		while(_entries[i].used) {
+			if(_entries[i].key==key) {
+				_entries[i].value = value;
+				return;
+			}
+			i = (i+1)&mask;
+		}
+		_entries[i].key = key;
+		_entries[i].value = value;
+		_entries[i].used = true;
+		++_count;
+	}
+
+	bool erase(const Key& key) {
+		if(_count==0)
+			return false;
+		Poco::UInt32 mask = _entries.size()-1;
+		Poco::UInt32 i = key.hash()&mask;
+		while(_entries[i].used && !(_entries[i].key==key))
+			i = (i+1)&mask;
+		if(!_entries[i].used)
+			return false;
+		// shift back the following entries of the cluster which can take the hole
+		Poco::UInt32 hole = i;
+		for(;;) {
+			i = (i+1)&mask;
+			if(!_entries[i].used)
+				break;
+			Poco::UInt32 home = _entries[i].key.hash()&mask;
+			if(((i-home)&mask) >= ((i-hole)&mask)) {
+				_entries[hole] = _entries[i];
+				hole = i;
+			}
+		}
+		_entries[hole] = Entry();
+		--_count;
+		return true;
+	}
+
+	void clear() {
+		_entries.clear();
+		_count=0;
+	}
+
+	Poco::UInt32 size() const {
+		return _count;
+	}
+
+	void values(std::vector<Value>& values) const {
+		typename std::vector<Entry>::const_iterator it;
+		for(it=_entries.begin();it!=_entries.end();++it) {
+			if(it->used)
+				values.push_back(it->value);
+		}
+	}
+
+private:
+	struct Entry {
+		Entry() : value(),used(false) {}
+		Key		key;
+		Value	value;
+		bool	used;
+	};
+
+	void grow() {
+		std::vector<Entry> entries(_entries.empty() ? 16 : _entries.size()*2);
+		entries.swap(_entries);
+		_count=0;
+		typename std::vector<Entry>::const_iterator it;
+		for(it=entries.begin();it!=entries.end();++it) {
+			if(it->used)
+				set(it->key,it->value);
+		}
+	}
+
+	std::vector<Entry>	_entries;
+	Poco::UInt32		_count;
+};
+
+
+} // namespace Cumulus
@@ -0,0 +1,105 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#if defined(__linux__)
+	#include <linux/io_uring.h>
+	// multishot receptions with a provided buffer ring are required (linux 6.0)
+	#if defined(IORING_RECV_MULTISHOT)
+		#define CUMULUS_URING
+	#endif
+#endif
+
+#if defined(CUMULUS_URING)
+
+namespace Cumulus {
+
+// Minimal io_uring wrapper on the raw system calls (liburing is not required).
+// Not thread-safe: the submission and the completion queues must be used by one thread at a time.
+class IOUring {
+public:
+	IOUring();
+	virtual ~IOUring();
+
+	// Returns the error (negative errno) or 0
+	int					open(Poco::UInt32 entries,Poco::UInt32 cqEntries);
+	void				close();
+	int					fd() const;
+
+	// Next free submission entry, cleared, or NULL if the submission queue is full
+	struct io_uring_sqe*	sqe();
+	// Submits the entries prepared, and waits 'wait' completions. Returns the number of entries submitted or the error (negative errno)
+	int					submit(Poco::UInt32 wait=0);
+	// Withdraws the entries prepared and not consumed by the last submit (without SQPOLL the kernel reads them only in submit)
+	void				discard();
+
+	// Next completion, or NULL if the completion queue is empty, seen() releases it
+	struct io_uring_cqe*	cqe();
+	void				seen();
+
+	// Registers a ring of 'count' buffers (power of 2) of 'size' bytes for the operations with IOSQE_BUFFER_SELECT
+	int					registerBuffers(Poco::UInt16 group,Poco::UInt8* buffers,Poco::UInt32 size,Poco::UInt16 count);
+	Poco::UInt8*		buffer(Poco::UInt16 id);
+	// Gives back a buffer to the kernel, visible for it after commitBuffers()
+	void				recycle(Poco::UInt16 id);
+	void				commitBuffers();
+
+private:
+	int						_fd;
+	void*					_pSQRing;
+	Poco::UInt32			_sqRingSize;
+	void*					_pCQRing;
+	Poco::UInt32			_cqRingSize;
+	struct io_uring_sqe*	_pSQEs;
+	Poco::UInt32			_sqesSize;
+
+	Poco::UInt32*			_pSQHead;
+	Poco::UInt32*			_pSQTail;
+	Poco::UInt32			_sqMask;
+	Poco::UInt32			_sqEntries;
+	Poco::UInt32*			_pSQArray;
+	Poco::UInt32			_sqTail;
+	Poco::UInt32			_toSubmit;
+
+	Poco::UInt32*			_pCQHead;
+	Poco::UInt32*			_pCQTail;
+	Poco::UInt32			_cqMask;
+	struct io_uring_cqe*	_pCQEs;
+
+	struct io_uring_buf_ring*	_pBufRing;
+	Poco::UInt32			_bufRingSize;
+	Poco::UInt16			_bufGroup;
+	Poco::UInt16			_bufMask;
+	Poco::UInt16			_bufTail;
+	Poco::UInt8*			_buffers;
+	Poco::UInt32			_bufSize;
+};
+
+inline int IOUring::fd() const {
+	return _fd;
+}
+
+inline Poco::UInt8* IOUring::buffer(Poco::UInt16 id) {
+	return &_buffers[id*_bufSize];
+}
+
+
+} // namespace Cumulus
+
+#endif
@@ -25,15 +25,16 @@ namespace Cumulus {
 
 class Listener {
 public:
-	Listener();
+	Listener(Poco::UInt8 shard=0);
 	virtual ~Listener();
 
 	void pushAudioPacket(PacketReader& packet); 
 	void pushVideoPacket(PacketReader& packet);
-	
-private:
 	void pushPacket(Poco::UInt8 type,PacketReader& packet);
 
+	// Worker which owns the listener, the only one which can push it
+	const Poco::UInt8	shard;
+private:
 	virtual void flush()=0;
 	virtual BinaryWriter& writer()=0;
 };
@@ -0,0 +1,51 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+
+namespace Cumulus {
+
+class LockFreeQueue;
+class QueueNode {
+	friend class LockFreeQueue;
+public:
+	QueueNode() : _pNext(NULL) {}
+	virtual ~QueueNode() {}
+private:
+	QueueNode* volatile	_pNext;
+};
+
+// Intrusive multi-producer single-consumer queue without lock:
+// push can be called by any thread, pop only by the consumer thread
+class LockFreeQueue {
+public:
+	LockFreeQueue();
+	virtual ~LockFreeQueue();
+
+	void		push(QueueNode* pNode);
+	QueueNode*	pop(); // returns NULL if the queue is empty (or if a push is not yet completed)
+
+private:
+	QueueNode* volatile	_pHead;
+	QueueNode*			_pTail;
+	QueueNode			_stub;
+};
+
+
+} // namespace Cumulus
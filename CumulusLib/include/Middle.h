@@ -21,7 +21,7 @@
 #include "Session.h"
 #include "Cirrus.h"
 #include "Poco/URI.h"
-#include <openssl/dh.h>
+#include "DHEngine.h"
 
 namespace Cumulus {
 
@@ -33,12 +33,13 @@ public:
 			const Peer& peer,
 			const Poco::UInt8* decryptKey,
 			const Poco::UInt8* encryptKey,
-			Poco::Net::DatagramSocket& socket,
+			DatagramEngine& engine,
 			ServerHandler& serverHandler,
 			Cirrus& cirrus);
 	~Middle();
 
 	const Peer&			middlePeer();
+	const Poco::Net::DatagramSocket&	cirrusSocket();
 
 	void				cirrusPacketHandler(PacketReader& packet);
 
@@ -63,7 +64,7 @@ private:
 	Poco::UInt32				_middleId;
 	Peer						_middlePeer;
 	std::string					_middleCertificat;
-	DH*							_pMiddleDH;
+	DHEngine*					_pMiddleDH;
 	Cirrus&						_cirrus;
 
 	Poco::Net::DatagramSocket	_socket;
@@ -78,5 +79,9 @@ inline const Peer& Middle::middlePeer() {
 	return _middlePeer;
 }
 
+inline const Poco::Net::DatagramSocket& Middle::cirrusSocket() {
+	return _socket;
+}
+
 
 } // namespace Cumulus
@@ -0,0 +1,109 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "PacketReader.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+#include <vector>
+
+#define CACHE_LINE_SIZE		64
+// Each buffer is a cache line of header followed by PACKETRECV_SIZE bytes of data, aligned on cache lines
+#define PACKET_BUFFER_SLOT	(CACHE_LINE_SIZE+((PACKETRECV_SIZE+CACHE_LINE_SIZE-1)&~(CACHE_LINE_SIZE-1)))
+
+namespace Cumulus {
+
+class PacketPool;
+class PacketBuffer {
+	friend class PacketPool;
+public:
+	Poco::UInt8*	data();
+	// Thread-safe, the last release gives back the buffer to its pool
+	void			retain();
+	void			release();
+
+private:
+	PacketBuffer(PacketPool& pool);
+	~PacketBuffer();
+
+	PacketPool&				_pool;
+	PacketBuffer*			_pNext;
+	Poco::AtomicCounter		_references;
+};
+
+inline Poco::UInt8* PacketBuffer::data() {
+	return (Poco::UInt8*)this+CACHE_LINE_SIZE;
+}
+
+inline void PacketBuffer::retain() {
+	++_references;
+}
+
+
+// Pool of packet buffers shared by the workers, it grows by slabs (of huge pages if asked and possible) and never shrinks
+class PacketPool {
+	friend class PacketBuffer;
+public:
+	PacketPool(Poco::UInt32 slabBuffers=256,bool hugePages=false);
+	virtual ~PacketPool();
+
+	// Returns a buffer with one reference
+	PacketBuffer*	acquire();
+
+	Poco::UInt32	capacity();
+	Poco::UInt32	used();
+	Poco::UInt32	highWater();
+
+private:
+	void			giveBack(PacketBuffer* pBuffer);
+	void			grow();
+
+	struct Slab {
+		Poco::UInt8*	pMemory;
+		Poco::UInt32	size;
+		bool			mapped;
+	};
+
+	const Poco::UInt32		_slabBuffers;
+	bool					_hugePages;
+	Poco::FastMutex			_mutex;
+	PacketBuffer*			_pFree;
+	std::vector<Slab>		_slabs;
+	Poco::UInt32			_capacity;
+	Poco::UInt32			_used;
+	Poco::UInt32			_highWater;
+};
+
+inline Poco::UInt32 PacketPool::capacity() {
+	Poco::ScopedLock<Poco::FastMutex> lock(_mutex);
+	return _capacity;
+}
+
+inline Poco::UInt32 PacketPool::used() {
+	Poco::ScopedLock<Poco::FastMutex> lock(_mutex);
+	return _used;
+}
+
+inline Poco::UInt32 PacketPool::highWater() {
+	Poco::ScopedLock<Poco::FastMutex> lock(_mutex);
+	return _highWater;
+}
+
+
+} // namespace Cumulus
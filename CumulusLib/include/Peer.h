@@ -21,9 +21,14 @@
 #include "Client.h"
 #include "Address.h"
 #include "Poco/Net/SocketAddress.h"
+#include "Poco/Timestamp.h"
 #include <vector>
 #include <list>
 
+// Minimal move of the smoothed ping (in RTMFP time unit of 4 ms) to change the ranking of the peer in its groups,
+// the band is the ping variance when it's larger
+#define PING_HYSTERESIS		4
+
 namespace Cumulus {
 
 class Group;
@@ -38,21 +43,43 @@ public:
 	const std::vector<Address>		privateAddress;
 
 	void setPrivateAddress(const std::list<Address>& address);
+	// New round-trip time sample, smoothed with the RFC 6298 estimator
 	void setPing(Poco::UInt16 ping);
 	void unsubscribeGroups();
 
 	Poco::UInt16 getPing() const;
+	Poco::UInt16 getPingVariance() const;
+	// Retransmission timeout (srtt+4*rttvar) in microseconds
+	Poco::Timestamp::TimeDiff retransmissionTimeout() const;
 	bool isIn(Group& group) const;
 
 private:
-	bool isIn(Group& group,std::list<Group*>::iterator& it);
+	// Group of the peer, with the handle of the peer in the group
+	struct Membership {
+		Membership(Group* pGroup,Poco::UInt32 handle=0) : pGroup(pGroup),handle(handle) {}
+		bool operator<(const Membership& other) const { return pGroup<other.pGroup; }
+		Group*			pGroup;
+		Poco::UInt32	handle;
+	};
 
-	std::list<Group*>			_groups;
-	Poco::UInt16				_ping;
+	// small flat set, sorted by group address
+	std::vector<Membership>		_groups;
+	Poco::UInt32				_srtt; // scaled by 8
+	Poco::UInt32				_rttvar; // scaled by 4
+	bool						_pingSampled;
+	Poco::UInt16				_rankedPing; // ping used by the ranking of the groups
 };
 
 inline Poco::UInt16 Peer::getPing() const {
-	return _ping;
+	return ping;
+}
+
+inline Poco::UInt16 Peer::getPingVariance() const {
+	return pingVariance;
+}
+
+inline Poco::Timestamp::TimeDiff Peer::retransmissionTimeout() const {
+	return ((Poco::Timestamp::TimeDiff)ping+4*pingVariance)*4000;
 }
 
 
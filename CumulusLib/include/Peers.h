@@ -19,28 +19,114 @@
 
 #include "Cumulus.h"
 #include "Peer.h"
+#include "Poco/Random.h"
+#include <vector>
+#include <set>
+#include <string>
+
+// Number of peers given to a newcomer of a group, can be changed by build flag
+#ifndef MAX_BEST_PEERS
+#define MAX_BEST_PEERS		6
+#endif
+
+// Ping buckets of 16 RTMFP time units (64 ms), the last but one takes all the pings superior, the last is for the local peers
+#define PEERS_BUCKETS		32
+#define PEERS_PING_STEP		16
+#define PEERS_NONE			0xFFFFFFFF
+
+// Spreading of the introductions: the recent introductions of a peer (halved every INTRODUCTION_HALF_LIFE seconds)
+// move it of INTRODUCTION_PENALTY ping buckets each, among the PEERS_CANDIDATES peers of lowest ping
+#define INTRODUCTION_HALF_LIFE	60
+#define INTRODUCTION_PENALTY	2
+#define PEERS_CANDIDATES		(MAX_BEST_PEERS*4)
+#define INTRODUCTION_BINS		8
+
+// In proximity mode, minimal common prefix of the public addresses to consider two peers as near
+#define PROXIMITY_PREFIX_IPV4	16
+#define PROXIMITY_PREFIX_IPV6	32
 
 namespace Cumulus {
 
+// Distribution of the recent introductions of the members of a group
+class IntroductionStats {
+public:
+	IntroductionStats();
 
+	Poco::UInt32	members;
+	Poco::UInt32	introductions; // sum of the recent introductions
+	Poco::UInt32	max;
+	// members by recent introductions: 0, 1, 2-3, 4-7, ... 64 and more
+	Poco::UInt32	histogram[INTRODUCTION_BINS];
+};
+
+// Members of a group ranked by ping.
+// Every member is a node of an array (reused after removal), linked in the list of its ping bucket,
+// and the peer keeps the handle (index of the node) to be updated and removed without search or allocation.
+// In proximity mode, the members are indexed too in the radix order of their addresses (public then private),
+// where the peers which share the longest prefix with an address are its neighbors.
 class Peers {
 public:
-	Peers();
+	Peers(bool proximity=false);
 	virtual ~Peers();
 	
-	void add(const Peer& peer);
-	void remove(const Peer& peer);
-	void update(const Peer& peer,Poco::UInt16 oldPing);
-	void best(std::list<const Peer*>& peers,const Peer& askerPeer) const;
+	// Returns the handle of the peer
+	Poco::UInt32 add(const Peer& peer,Poco::UInt16 ping);
+	void remove(Poco::UInt32 handle);
+	void update(Poco::UInt32 handle,Poco::UInt16 ping);
+	// Gives the MAX_BEST_PEERS peers of lowest ping (except the asker), the peers recently introduced a lot are penalized
+	// and the ties are broken randomly. In proximity mode the nearest peers of the asker come first.
+	void best(std::list<const Peer*>& peers,const Peer& askerPeer);
+	void introductions(IntroductionStats& stats) const;
 	bool empty() const;
+	Poco::UInt32 count() const;
 private:
-	
-	std::list<const Peer*>							_localPeers;
-	std::map<Poco::UInt16,std::list<const Peer*>*>	_peers;
+	struct Node {
+		const Peer*		pPeer;
+		Poco::UInt32	prev;
+		Poco::UInt32	next; // next free node when the node is free
+		Poco::UInt8		bucket;
+		std::string		proximityKey;
+		Poco::UInt16	introductions;
+		Poco::UInt32	introductionTime; // in seconds
+	};
+
+	static Poco::UInt8 Bucket(Poco::UInt16 ping);
+	// 16 bytes of public host + 16 bytes of first private host (IPv4 are mapped in IPv6), then the handle
+	static void ProximityKey(const Peer& peer,Poco::UInt32 handle,std::string& key);
+	static Poco::UInt16 CommonPrefix(const std::string& key1,const std::string& key2);
+
+	// Fills 'handles' with the nearest peers of the asker, returns their number
+	Poco::UInt8 nearest(const Peer& askerPeer,Poco::UInt32* handles) const;
+	// Recent introductions of the node (decayed at the time 'now')
+	Poco::UInt16 introductions(const Node& node,Poco::UInt32 now) const;
+	void introduce(Poco::UInt32 handle,Poco::UInt32 now);
+
+	void link(Poco::UInt32 handle,Poco::UInt8 bucket);
+	void unlink(Poco::UInt32 handle);
+
+	std::vector<Node>	_nodes;
+	Poco::UInt32		_free;
+	Poco::UInt32		_heads[PEERS_BUCKETS];
+	Poco::UInt32		_filled; // bit mask of the buckets not empty
+	Poco::UInt32		_count;
+
+	const bool				_proximity;
+	std::set<std::string>	_proximityIndex;
+
+	Poco::Random			_random;
 };
 
 inline bool Peers::empty() const {
-	return _localPeers.size()==0 && _peers.size()==0;
+	return _count==0;
+}
+
+inline Poco::UInt32 Peers::count() const {
+	return _count;
+}
+
+inline Poco::UInt8 Peers::Bucket(Poco::UInt16 ping) {
+	Poco::UInt16 bucket = ping/PEERS_PING_STEP;
+	return bucket>=(PEERS_BUCKETS-1) ? (PEERS_BUCKETS-2) : (Poco::UInt8)bucket;
 }
 
 
@@ -21,7 +21,7 @@
 #include "PacketReader.h"
 #include "AESEngine.h"
 #include "Poco/Timestamp.h"
-#include <openssl/dh.h>
+#include "DHEngine.h"
 
 namespace Cumulus {
 
@@ -29,6 +29,8 @@ namespace Cumulus {
 #define RTMFP_DEFAULT_PORT 1935
 #define RTMFP_MIN_PACKET_SIZE 12
 #define RTMFP_MAX_PACKET_LENGTH 1182
+// Part of packet decrypted then summed while it's still in the L1 cache (a multiple of AES_BLOCK_SIZE)
+#define RTMFP_DECODE_CHUNK 256
 
 class RTMFP
 {
@@ -40,11 +42,18 @@ public:
 	static bool						Decode(AESEngine& aesDecrypt,PacketReader& packet);
 	static void						Encode(PacketWriter& packet);
 	static void						Encode(AESEngine& aesEncrypt,PacketWriter& packet);
+	// Encode and Pack together on the buffer of the packet, without allocation.
+	// Two passes: the checksum is in the first block of the CBC chain, so the packet is summed before its encryption
+	// (Decode can sum each part after its decryption, Finalize can't do the same)
+	static void						Finalize(PacketWriter& packet,Poco::UInt32 farId=0);
+	static void						Finalize(AESEngine& aesEncrypt,PacketWriter& packet,Poco::UInt32 farId=0);
 	
 	static Poco::UInt16				CheckSum(PacketReader& packet);
+	static Poco::UInt16				CheckSum(const Poco::UInt8* data,int size);
 
-	static DH*						BeginDiffieHellman(Poco::UInt8* pubKey);
-	static void						EndDiffieHellman(DH* pDH,const Poco::UInt8* farPubKey,Poco::UInt8* sharedSecret);
+	static DHEngine*				BeginDiffieHellman(Poco::UInt8* pubKey);
+	// Deletes pDH, returns false if the far public key is invalid (sharedSecret is then not filled)
+	static bool						EndDiffieHellman(DHEngine* pDH,const Poco::UInt8* farPubKey,Poco::UInt8* sharedSecret);
 
 	static void						ComputeAsymetricKeys(const Poco::UInt8* sharedSecret,
 														 const Poco::UInt8* serverPubKey,
@@ -56,6 +65,14 @@ public:
 	static Poco::UInt16				Time(Poco::Timestamp::TimeVal timeVal);
 
 private:
+	// Decrypts 'data' (the packet after the id session) and checks its checksum in the same pass
+	static bool						Decode(AESEngine& aesDecrypt,Poco::UInt8* data,int size);
+	// Sum of the big endian 16 bits words, an odd last byte is added alone, without carry folding
+	static Poco::UInt32				Sum(const Poco::UInt8* data,int size);
+	static Poco::UInt16				Fold(Poco::UInt32 sum);
+	// Pads, writes the checksum and encrypts 'data' (the packet after the id session), returns the new size
+	static int						Encode(AESEngine& aesEncrypt,Poco::UInt8* data,int size);
+	static void						Pack(Poco::UInt8* data,Poco::UInt32 farId);
 
 	static AESEngine				s_aesDecrypt;
 	static AESEngine				s_aesEncrypt;
@@ -72,6 +89,10 @@ inline void RTMFP::Encode(PacketWriter& packet) {
 	Encode(s_aesEncrypt,packet);
 }
 
+inline void RTMFP::Finalize(PacketWriter& packet,Poco::UInt32 farId) {
+	Finalize(s_aesEncrypt,packet,farId);
+}
+
 inline Poco::UInt16 RTMFP::TimeNow() {
 	return Time(Poco::Timestamp().epochMicroseconds());
 }
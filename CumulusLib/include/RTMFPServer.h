@@ -19,21 +19,38 @@
 
 #include "Cumulus.h"
 #include "Session.h"
-#include "PacketReader.h"
-#include "Handshake.h"
 #include "ServerHandler.h"
 #include "Cirrus.h"
-#include "Gateway.h"
-#include "Poco/Runnable.h"
+#include "RTMFPWorker.h"
+#include "DHPool.h"
 #include "Poco/Mutex.h"
-#include "Poco/Thread.h"
-#include "Poco/Net/DatagramSocket.h"
 #include "Poco/Net/SocketAddress.h"
+#include <vector>
 
 
 namespace Cumulus {
 
-class CUMULUS_API RTMFPServer : public Poco::Runnable,private Gateway {
+class CUMULUS_API RTMFPServerParams {
+public:
+	RTMFPServerParams() : port(RTMFP_DEFAULT_PORT),pCirrus(NULL),batchSize(0),uring(false),threads(1),steering(true),hugePages(false),cryptoThreads(0),proximity(false),dhPoolDepth(0),dhThreads(1),statelessCookies(false) {
+	}
+	Poco::UInt16					port;
+	const Poco::Net::SocketAddress*	pCirrus;
+	Poco::UInt16					batchSize; // datagrams received/sent by system call, 0 or 1 for the classic path
+	bool							uring; // io_uring datagram engine if the kernel supports it (linux only), otherwise batch mode
+	Poco::UInt8						threads; // workers listening the same port (SO_REUSEPORT), always 1 in the middle mode
+	bool							steering; // kernel gives each packet to the socket of the worker which owns its session (linux only)
+	bool							hugePages; // packet buffers allocated in huge pages (linux only, if the system has reserved some)
+	Poco::UInt8						cryptoThreads; // pipeline mode if not 0: threads which decrypt the packets in parallel
+	bool							proximity; // a newcomer of a group receives first the members the nearest of its address
+	Poco::UInt16					dhPoolDepth; // Diffie-Hellman keypairs generated in advance for the handshakes, 0 to generate them during the handshake
+	Poco::UInt8						dhThreads; // threads which fill the Diffie-Hellman pool
+	bool							statelessCookies; // handshake cookies signed by HMAC rather than kept in a table
+};
+
+// Each worker handles its own sessions without lock (see RTMFPWorker::dispatch)
+class CUMULUS_API RTMFPServer : private StreamRelay {
+	friend class RTMFPWorker;
 public:
 	RTMFPServer(Poco::UInt8 keepAliveServer=15,Poco::UInt8 keepAlivePeer=10);
 	RTMFPServer(ClientHandler& clientHandler,Poco::UInt8 keepAliveServer=15,Poco::UInt8 keepAlivePeer=10);
@@ -41,35 +58,45 @@ public:
 
 	void start(Poco::UInt16 port=RTMFP_DEFAULT_PORT,const Poco::Net::SocketAddress* pCirrus=NULL);
 	void start(const Poco::Net::SocketAddress* pCirrus);
+	void start(const RTMFPServerParams& params);
 	void stop();
 	bool running();
+	// Metrics of the Diffie-Hellman pool while the server runs, false without pool
+	bool dhPoolStats(DHPoolStats& stats);
 
 private:
-	Session* findSession(Poco::UInt32 id);
-	void	 run();
-	Poco::UInt8		p2pHandshake(const std::string& tag,PacketWriter& response,const Poco::Net::SocketAddress& address,const Poco::UInt8* peerIdWanted);
-	Poco::UInt32	createSession(Poco::UInt32 farId,const Peer& peer,const Poco::UInt8* decryptKey,const Poco::UInt8* encryptKey);
-
-	Handshake					_handshake;
+	void			 init();
+	void			 attachSteering();
+	RTMFPWorker*	 worker(Poco::UInt32 idSession);
+	// Search in the sessions of all the workers, returns the session id (0 if not found)
+	Poco::UInt32	 findSession(const Poco::UInt8* peerId);
+	Poco::UInt32	 findSession(const Poco::Net::SocketAddress& address);
+	void			 relay(Poco::UInt8 shard,const std::string& name,Poco::UInt8 type,PacketReader& packet);
 
 	volatile bool				_terminate;
 	Poco::FastMutex				_mutex;
 	Poco::UInt16				_port;
-	Poco::Thread				_mainThread;
-	Poco::Net::DatagramSocket	_socket;
+	Poco::UInt16				_batchSize;
+	bool						_uring;
+	bool						_statelessCookies;
+	Poco::UInt8					_certificat[77];
+	std::vector<RTMFPWorker*>	_workers;
+	PacketPool*					_pPool;
+	CryptoPool*					_pCryptoPool;
+	DHPool*						_pDHPool;
+	Poco::FastMutex				_dhPoolMutex; // not _mutex, the metrics can be read by a worker while stop() joins them
 
 	Cirrus*						_pCirrus;
 	ServerHandler				_handler;
-	Sessions					_sessions;
-	Poco::UInt32				_nextIdSession;
 };
 
 inline void RTMFPServer::start(const Poco::Net::SocketAddress* pCirrus) {
 	start(RTMFP_DEFAULT_PORT,pCirrus);
 }
 
-inline bool RTMFPServer::running() {
-	return _mainThread.isRunning();
+inline RTMFPWorker* RTMFPServer::worker(Poco::UInt32 idSession) {
+	Poco::UInt32 index = SESSION_SHARD(idSession);
+	return index<_workers.size() ? _workers[index] : NULL;
 }
 
 
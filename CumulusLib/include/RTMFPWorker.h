@@ -0,0 +1,174 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Session.h"
+#include "Sessions.h"
+#include "Handshake.h"
+#include "Gateway.h"
+#include "DatagramEngine.h"
+#include "Reactor.h"
+#include "LockFreeQueue.h"
+#include "CryptoPool.h"
+#include "AESEngine.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Net/DatagramSocket.h"
+#include "Poco/Net/SocketAddress.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace Cumulus {
+
+class RTMFPServer;
+class RTMFPWorker : public Poco::Runnable,private Gateway {
+	friend class RTMFPServer;
+public:
+	RTMFPWorker(RTMFPServer& server,Poco::UInt8 index,const Poco::UInt8* certificat);
+	virtual ~RTMFPWorker();
+
+	const Poco::UInt8	index;
+
+	Sessions&			sessions();
+	// Called by an other worker when it has received a packet for a session of this worker
+	void				forward(PacketBuffer* pBuffer,int size,const Poco::Net::SocketAddress& sender);
+	// Called by the worker of a publisher, to push its media to the listeners of this worker
+	void				relay(const std::string& name,Poco::UInt8 type,PacketReader& packet);
+	// Thread-safe, unblocks the worker to check the termination
+	void				wakeUp();
+
+private:
+	class Datagram : public QueueNode {
+	public:
+		Datagram(PacketBuffer* pBuffer,int size,const Poco::Net::SocketAddress& sender);
+		~Datagram();
+		PacketBuffer* const			pBuffer;
+		const int					size;
+		const Poco::Net::SocketAddress	sender;
+	};
+
+	// Hole punching of a peer whose the session or the session wanted is owned by an other worker:
+	// the worker of the requester session gives its private addresses, then the worker of the wanted session
+	// introduces the requester and responds to the handshake
+	class Introduction : public QueueNode {
+	public:
+		Introduction(const std::string& tag,const Poco::Net::SocketAddress& address,Poco::UInt32 idSession,Poco::UInt32 idSessionWanted);
+		~Introduction();
+
+		const std::string				tag;
+		const Poco::Net::SocketAddress	address;
+		Poco::UInt32					idSession; // 0 once its private addresses are given (or if the requester has no session)
+		const Poco::UInt32				idSessionWanted;
+		std::vector<Address>			privateAddress;
+		bool							known; // the requester session has been found
+	};
+
+	// Media of a publication relayed by the worker of the publisher
+	class Media : public QueueNode {
+	public:
+		Media(const std::string& name,Poco::UInt8 type,PacketReader& packet);
+		~Media();
+
+		const std::string		name;
+		const Poco::UInt8		type;
+		const std::string		data;
+	};
+
+	// Decryption of a packet by the crypto pool, in pipeline mode, with the engine of its session:
+	// one packet by session at a time, and the session lives until the end of its decryption (Session::decrypting)
+	class Decoding : public CryptoJob,public QueueNode {
+	public:
+		Decoding(RTMFPWorker& worker,Poco::UInt32 idSession,AESEngine& aesDecrypt,PacketBuffer* pBuffer,int size,const Poco::Net::SocketAddress& sender);
+		~Decoding();
+		void process();
+
+		const Poco::UInt32				idSession;
+		PacketBuffer* const				pBuffer;
+		const int						size;
+		const Poco::Net::SocketAddress	sender;
+		volatile bool					decoded;
+	private:
+		RTMFPWorker&					_worker;
+		AESEngine&						_aesDecrypt;
+	};
+
+	Session*		findSession(Poco::UInt32 id);
+	void			bind();
+	void			open();
+	void			run();
+	void			receive();
+	// Returns the session of the packet, or NULL if the packet has been processed (echo, invalid, forwarded or unknown)
+	Session*		route(PacketReader& packet,const Poco::Net::SocketAddress& sender,int slot,PacketBuffer* pBuffer,Poco::UInt32& idSession);
+	void			receiveForwarded();
+	void			dispatchDecoded();
+	// Pushes the first packet waiting its decryption of the session to the crypto pool
+	void			decrypt(Session& session,std::deque<Decoding*>& decodings);
+	// At the end, waits the decryptions in progress which use the engines of the sessions
+	void			waitDecoded();
+	void			dispatchExchanged();
+	void			dispatchIntroductions();
+	void			dispatchMedia();
+	// Thread-safe, gives the introduction to this worker
+	void			post(Introduction* pIntroduction);
+	// Does the step of the introduction which concerns this worker, or gives it to the worker concerned
+	void			introduce(Introduction* pIntroduction);
+	// Called by a thread of the crypto pool
+	void			decoded(Decoding* pDecoding);
+	void			dispatch(Poco::UInt32 idSession,PacketReader& packet,bool valid,const Poco::Net::SocketAddress& sender);
+	// The datagram is in the engine slot 'slot', or in 'pBuffer' if it has been forwarded
+	void			packetHandler(Poco::UInt8* data,int size,const Poco::Net::SocketAddress& sender,int slot,PacketBuffer* pBuffer=NULL);
+	PacketBuffer*	keep(int slot,PacketBuffer* pBuffer);
+	Poco::UInt8		p2pHandshake(const std::string& tag,PacketWriter& response,const Poco::Net::SocketAddress& address,const Poco::UInt8* peerIdWanted);
+	Poco::UInt32	createSession(Poco::UInt32 farId,const Peer& peer,const Poco::UInt8* decryptKey,const Poco::UInt8* encryptKey);
+	void			keyExchanged(KeyExchange* pKeyExchange);
+
+	RTMFPServer&				_server;
+	Poco::Thread				_thread;
+	Poco::Net::DatagramSocket	_socket;
+	DatagramEngine				_engine;
+	Reactor						_reactor;
+	Handshake					_handshake;
+	Sessions					_sessions;
+
+	// Packets forwarded by the other workers
+	LockFreeQueue				_forwarded;
+	Poco::AtomicCounter			_wakeups;
+
+	// Pipeline mode: packets decrypted by the crypto pool, and by session in arrival order the packet in decryption then the packets waiting
+	LockFreeQueue				_decoded;
+	std::map<Poco::UInt32,std::deque<Decoding*> >	_decodings;
+	// Key exchanges of handshakes done by the crypto pool (owned by the handshake)
+	LockFreeQueue				_exchanged;
+	// Hole punchings and media given by the other workers
+	LockFreeQueue				_introductions;
+	LockFreeQueue				_media;
+};
+
+inline Sessions& RTMFPWorker::sessions() {
+	return _sessions;
+}
+
+inline void RTMFPWorker::wakeUp() {
+	_reactor.wakeUp();
+}
+
+
+} // namespace Cumulus
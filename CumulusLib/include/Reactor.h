@@ -0,0 +1,90 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Net/Socket.h"
+#include "Poco/Net/DatagramSocket.h"
+#include <vector>
+
+#define REACTOR_MAX_EVENTS	64
+
+struct epoll_event;
+
+namespace Cumulus {
+
+// Waits the readable sockets of a worker, the ticks of a periodic timer, and the wake up calls of the other threads.
+// epoll with a timerfd and an eventfd on linux, Socket::select and a loopback socket elsewhere.
+// A socket closed is forgotten automatically.
+class Reactor {
+public:
+	Reactor();
+	virtual ~Reactor();
+
+	// period of the timer in microseconds
+	void			open(Poco::UInt32 period);
+	// Not thread-safe with wakeUp(), the threads which can wake up the reactor must be stopped before
+	void			close();
+
+	void			add(const Poco::Net::Socket& socket,Poco::UInt32 tag);
+#if defined(__linux__)
+	void			add(int fd,Poco::UInt32 tag);
+#endif
+	// Thread-safe, unblocks wait()
+	void			wakeUp();
+
+	// Waits at least one event, and returns the number of sockets readable
+	int				wait();
+	Poco::UInt32	tag(int index) const;
+	bool			timer() const;
+	bool			woken() const;
+
+private:
+	Poco::UInt32					_period;
+	bool							_timer;
+	bool							_woken;
+	std::vector<Poco::UInt32>		_tags;
+
+#if defined(__linux__)
+	int								_epoll;
+	int								_timerFd;
+	int								_eventFd;
+	struct epoll_event*				_pEvents;
+#else
+	Poco::Timestamp					_nextTick;
+	Poco::Net::DatagramSocket*		_pWakeSocket;
+	std::vector<Poco::Net::Socket>	_sockets;
+	std::vector<Poco::UInt32>		_socketTags;
+#endif
+};
+
+inline Poco::UInt32 Reactor::tag(int index) const {
+	return _tags[index];
+}
+
+inline bool Reactor::timer() const {
+	return _timer;
+}
+
+inline bool Reactor::woken() const {
+	return _woken;
+}
+
+
+} // namespace Cumulus
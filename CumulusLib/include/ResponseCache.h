@@ -0,0 +1,90 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+#include "HashIndex.h"
+#include "Poco/Timestamp.h"
+#include <vector>
+
+namespace Cumulus {
+
+#define RESPONSE_KEY_SIZE	0x52
+#define RESPONSE_TIMEOUT	10000000 // 10 sec of retransmissions
+#ifndef RESPONSE_CAPACITY
+	#define RESPONSE_CAPACITY	1024
+#endif
+
+// Key of a cached response (a tag or a cookie followed by the address of the sender, RESPONSE_KEY_SIZE bytes at most)
+class ResponseKey {
+public:
+	ResponseKey();
+	ResponseKey(const Poco::UInt8* value,Poco::UInt8 size);
+
+	Poco::UInt32	hash() const;
+	bool			operator==(const ResponseKey& other) const;
+private:
+	Poco::UInt8		_value[RESPONSE_KEY_SIZE];
+	Poco::UInt8		_size;
+	Poco::UInt32	_hash;
+};
+
+class CachedResponse {
+public:
+	CachedResponse();
+	virtual ~CachedResponse();
+
+	ResponseKey					key;
+	Poco::UInt8					id;
+	std::string					content;
+	Poco::Timestamp::TimeVal	created;
+};
+
+// Serialized handshake responses kept RESPONSE_TIMEOUT to answer the retransmissions of their requests,
+// in a ring of fixed capacity ordered by creation time (the oldest is replaced when the ring is full)
+class ResponseCache {
+public:
+	ResponseCache(Poco::UInt32 capacity=RESPONSE_CAPACITY);
+	virtual ~ResponseCache();
+
+	const CachedResponse*	find(const Poco::UInt8* key,Poco::UInt8 size) const;
+	void					add(const Poco::UInt8* key,Poco::UInt8 size,Poco::UInt8 id,const Poco::UInt8* content,int contentSize,Poco::Timestamp::TimeVal now);
+	void					expire(Poco::Timestamp::TimeVal now);
+	void					clear();
+
+	Poco::UInt32			count() const;
+
+private:
+	void					pop();
+
+	std::vector<CachedResponse>					_responses;
+	Poco::UInt32								_oldest;
+	Poco::UInt32								_count;
+	HashIndex<ResponseKey,CachedResponse*>		_index;
+};
+
+inline Poco::UInt32 ResponseCache::count() const {
+	return _count;
+}
+
+inline const CachedResponse* ResponseCache::find(const Poco::UInt8* key,Poco::UInt8 size) const {
+	return _index.find(ResponseKey(key,size));
+}
+
+
+} // namespace Cumulus
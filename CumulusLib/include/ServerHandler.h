@@ -23,29 +23,46 @@
 #include "AMFWriter.h"
 #include "AMFReader.h"
 #include "Streams.h"
+#include "HashIndex.h"
+#include "Poco/Mutex.h"
 
 namespace Cumulus {
 
+// Shared by the workers: the client handler is called by one worker at a time,
+// and the groups (registry, members and their ranking) are used with groupsMutex() locked
 class ServerHandler
 {
+	friend class Group;
 public:
 	ServerHandler(Poco::UInt8 keepAliveServer,Poco::UInt8 keepAlivePeer,ClientHandler* pClientHandler);
 	virtual ~ServerHandler();
 
+	Poco::FastMutex&	groupsMutex();
+	// Finds or creates the group
 	Group&	group(const std::vector<Poco::UInt8>& id);
+	Group*	findGroup(const std::vector<Poco::UInt8>& id) const;
 
 	bool connection(Peer& peer);
 	void failed(Peer& peer,const std::string& msg);
 	void disconnection(Peer& peer);
 
 	Streams				streams;
+	bool				proximity; // best peers of a group chosen by address proximity first (see Peers)
 
 	const Poco::UInt32	keepAlivePeer;
 	const Poco::UInt32	keepAliveServer;
 private:
+	void	deleteGroup(Group& group);
+
 	ClientHandler*					_pClientHandler;
-	std::list<Group*>				_groups;
+	Poco::FastMutex					_clientMutex;
+	Poco::FastMutex					_groupsMutex;
+	HashIndex<GroupKey,Group*>		_groups;
 };
 
+inline Poco::FastMutex& ServerHandler::groupsMutex() {
+	return _groupsMutex;
+}
+
 
 } // namespace Cumulus
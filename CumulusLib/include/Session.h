@@ -24,15 +24,17 @@
 #include "RTMFP.h"
 #include "Flow.h"
 #include "FlowNull.h"
+#include "DatagramEngine.h"
+#include "TimerWheel.h"
 #include "Poco/Timestamp.h"
-#include "Poco/Net/DatagramSocket.h"
 
 #define SYMETRIC_ENCODING	0x01
 #define WITHOUT_ECHO_TIME   0x02
 
 namespace Cumulus {
 
-class Session {
+// The session is scheduled in the timer wheel of its worker to be managed only when it needs
+class Session : public Timer {
 public:
 
 	Session(Poco::UInt32 id,
@@ -40,7 +42,7 @@ public:
 			const Peer& peer,
 			const Poco::UInt8* decryptKey,
 			const Poco::UInt8* encryptKey,
-			Poco::Net::DatagramSocket& socket,
+			DatagramEngine& engine,
 			ServerHandler& serverHandler);
 
 	virtual ~Session();
@@ -53,16 +55,24 @@ public:
 	bool				died() const;
 	bool				failed() const;
 	virtual void		manage();
+	// Delay before the next manage is required (0 means on the next tick)
+	Poco::Timestamp::TimeDiff	nextManage() const;
+	void				manageSoon();
 	void				flush(Poco::UInt8 flags=0);
 	PacketWriter&		writeMessage(Poco::UInt8 type,Poco::UInt16 length);
 	PacketWriter&		writer();
 
-	void	p2pHandshake(const Poco::Net::SocketAddress& address,const std::string& tag,Session* pSession);
-	bool	decode(PacketReader& packet,const Poco::Net::SocketAddress& sender);
+	// Introduces the peer at 'address', with the private addresses of its session if it's known
+	void	p2pHandshake(const Poco::Net::SocketAddress& address,const std::string& tag,const std::vector<Address>* pPrivateAddress);
+	bool	decode(PacketReader& packet);
+	AESEngine&			aesDecrypt();
+	void	setAddress(const Poco::Net::SocketAddress& address);
 	
 	void	fail(const std::string& msg);
 
 	bool	_testDecode; // TODO enlever!
+	// A packet of the session is in decryption by the crypto pool with its engine (pipeline mode), the session isn't deleted until its end
+	bool	decrypting;
 protected:
 	void			setFailed(const std::string& msg);
 	virtual void	fail();
@@ -89,11 +99,11 @@ private:
 
 	Poco::UInt32				_id;
 
-	Poco::Net::DatagramSocket&	_socket;
+	DatagramEngine&				_engine;
 	AESEngine					_aesDecrypt;
 	AESEngine					_aesEncrypt;
 
-	Poco::UInt8					_buffer[PACKETSEND_SIZE];
+	PacketBuffer*				_pBuffer;
 	PacketWriter				_writer;
 
 	bool						_died;
@@ -102,6 +112,10 @@ private:
 	std::map<std::string,Poco::UInt8>		_p2pHandshakeAttemps;
 };
 
+inline AESEngine& Session::aesDecrypt() {
+	return _aesDecrypt;
+}
+
 inline void Session::fail(const std::string& msg) {
 	setFailed(msg);
 	fail();
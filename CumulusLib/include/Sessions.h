@@ -19,38 +19,113 @@
 
 #include "Cumulus.h"
 #include "Session.h"
+#include "TimerWheel.h"
+#include "HashIndex.h"
+#include "Poco/Mutex.h"
+#include "Poco/Net/SocketAddress.h"
 #include <cstddef>
+#include <vector>
+
+// The high byte of a session id is the index of the worker which owns the session
+#define SESSION_SHARD_SHIFT			24
+#define SESSION_SHARD(ID)			((ID)>>SESSION_SHARD_SHIFT)
+// Under the shard byte, a session id is made of a generation (6 bits) and of a slot in the table (18 bits, 262143 sessions by worker)
+#define SESSION_SLOT_BITS			18
+#define SESSION_SLOT_MASK			0x0003FFFF
+#define SESSION_GENERATION_MASK		0x3F
 
 namespace Cumulus {
 
+// Key of the index by address: the host bytes and the port
+class AddressKey {
+public:
+	AddressKey();
+	AddressKey(const Poco::Net::SocketAddress& address);
+
+	Poco::UInt32	hash() const;
+	bool			operator==(const AddressKey& other) const;
+private:
+	Poco::UInt8		_host[16];
+	Poco::UInt8		_size;
+	Poco::UInt16	_port;
+	Poco::UInt32	_hash;
+};
+
+// Key of the indexes by peer id (32 bytes)
+class PeerIdKey {
+public:
+	PeerIdKey();
+	PeerIdKey(const Poco::UInt8* id);
+
+	Poco::UInt32	hash() const;
+	bool			operator==(const PeerIdKey& other) const;
+private:
+	Poco::UInt8		_id[32];
+	Poco::UInt32	_hash;
+};
 
+// Sessions of one worker, in a table of slots indexed by the session id:
+// the lookup reads one slot, the id allocation takes the oldest freed slot (or a new one),
+// and the generation of the slot (incremented on each release) makes the id of a dead session invalid.
+// The sessions are iterated in a dense array.
+// Only the worker which owns the sessions uses them, the other workers can just search a session id by address or by peer id.
 class Sessions
 {
 public:
 
-	typedef std::map<Poco::UInt32,Session*>::const_iterator Iterator;
+	typedef std::vector<Session*>::const_iterator Iterator;
 
-	Sessions();
+	Sessions(Poco::UInt8 shard=0);
 	virtual ~Sessions();
 
 	Session* find(Poco::UInt32 id) const;
 	Session* find(const Poco::UInt8* peerId) const;
+	Session* find(const Poco::Net::SocketAddress& address) const;
+	// Thread-safe, returns the id of the session (0 if not found)
+	Poco::UInt32 findId(const Poco::UInt8* peerId) const;
+	Poco::UInt32 findId(const Poco::Net::SocketAddress& address) const;
 	
-	Session* add(Session* pSession);
+	// Id to give to the next session added, 0 if the table is full
+	Poco::UInt32	nextId() const;
+	Session*		add(Session* pSession);
+	Poco::UInt32	count() const;
+	// Updates the address of the session (and the index by address) on each packet received
+	void			setAddress(Session& session,const Poco::Net::SocketAddress& address);
 
 	Iterator begin() const;
 	Iterator end() const;
 
-	const Poco::UInt32	freqManage;
+	const Poco::UInt32	freqManage; // period of the manage calls, given to the timer of the worker
 	
+	// Called on each tick of freqManage, manages only the sessions whose the deadline has expired
 	void	manage();
 	void	clear();
 protected:
 	
 
 private:
-	std::map<Poco::UInt32,Session*>	_sessions;
-	Poco::Timestamp					_timeLastManage;
+	struct Slot {
+		Slot() : id(0),pSession(NULL),index(0),generation(0) {}
+		Poco::UInt32	id; // 0 when free
+		Session*		pSession;
+		Poco::UInt32	index; // position in _sessions, or next free slot when free
+		Poco::UInt8		generation;
+	};
+
+	void	schedule(Session& session);
+	void	remove(Session& session);
+
+	const Poco::UInt8		_shard;
+	std::vector<Slot>		_slots; // slot 0 is never used, to have never a null id
+	Poco::UInt32			_freeHead; // FIFO of free slots (0 if empty)
+	Poco::UInt32			_freeTail;
+	std::vector<Session*>	_sessions;
+	TimerWheel				_wheel;
+
+	// the indexes by address and by peer id are read by the other workers, they are changed with this mutex locked
+	mutable Poco::FastMutex			_mutex;
+	HashIndex<AddressKey,Session*>	_addresses;
+	HashIndex<PeerIdKey,Session*>	_peerIds;
 };
 
 inline Sessions::Iterator Sessions::begin() const {
@@ -61,6 +136,26 @@ inline Sessions::Iterator Sessions::end() const {
 	return _sessions.end();
 }
 
+inline Poco::UInt32 Sessions::count() const {
+	return _sessions.size();
+}
+
+inline Session* Sessions::find(const Poco::UInt8* peerId) const {
+	return _peerIds.find(peerId);
+}
+
+inline Session* Sessions::find(const Poco::Net::SocketAddress& address) const {
+	return _addresses.find(address);
+}
+
+inline Session* Sessions::find(Poco::UInt32 id) const {
+	Poco::UInt32 slot = id&SESSION_SLOT_MASK;
+	if(slot>=_slots.size())
+		return NULL;
+	const Slot& entry = _slots[slot];
+	return entry.id==id ? entry.pSession : NULL;
+}
+
 
 
 } // namespace Cumulus
@@ -20,6 +20,7 @@
 #include "Cumulus.h"
 #include "Listener.h"
 #include "Subscription.h"
+#include "Poco/Mutex.h"
 #include <set>
 #include <map>
 
@@ -27,11 +28,25 @@
 namespace Cumulus {
 
 
+// Relays the media of a publication to an other worker, which pushes them to its listeners
+class StreamRelay {
+public:
+	StreamRelay(){}
+	virtual ~StreamRelay(){}
+
+	virtual void relay(Poco::UInt8 shard,const std::string& name,Poco::UInt8 type,PacketReader& packet)=0;
+};
+
+// Shared by the workers, thread-safe.
+// The media of a publication are pushed by the worker of the publisher to its own listeners,
+// and relayed once to each other worker which has listeners
 class Streams {
 public:
 	Streams();
 	virtual ~Streams();
 
+	void			setRelay(StreamRelay* pRelay);
+
 	Poco::UInt32	create();
 	void			destroy(Poco::UInt32 id);
 
@@ -42,12 +57,19 @@ public:
 
 	Subscription*	subscription(Poco::UInt32 id);
 
+	// Media of the publisher 'idPublisher' received by the worker 'shard', returns false if it doesn't publish this subscription
+	bool			push(Subscription& subscription,Poco::UInt32 idPublisher,Poco::UInt8 type,PacketReader& packet,Poco::UInt8 shard);
+	// Media relayed by the worker of the publisher, pushed to the listeners of the worker 'shard'
+	void			relayed(const std::string& name,Poco::UInt8 type,PacketReader& packet,Poco::UInt8 shard);
+
 private:
 	typedef std::map<std::string,Subscription*>::iterator SubscriptionIt;
 
 	SubscriptionIt  subscriptionIt(const std::string& name);
 	void			cleanSubscription(SubscriptionIt& it);
 
+	Poco::FastMutex						_mutex;
+	StreamRelay*						_pRelay;
 	std::set<Poco::UInt32>				_streams;
 	std::map<std::string,Subscription*>	_subscriptions;
 	Poco::UInt32						_nextId;
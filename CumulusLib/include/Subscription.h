@@ -20,21 +20,23 @@
 #include "Cumulus.h"
 #include "Listener.h"
 #include <list>
+#include <vector>
 
 namespace Cumulus {
 
 class Subscription {
 public:
-	Subscription();
+	Subscription(const std::string& name);
 	virtual ~Subscription();
 
-	void				pushAudioPacket(PacketReader& packet);
-	void				pushVideoPacket(PacketReader& packet);
+	// Gives the listeners of the worker 'shard', and sets in 'shards' (256 bits) the other workers which have listeners
+	void				listeners(Poco::UInt8 shard,std::vector<Listener*>& listeners,Poco::UInt32* shards) const;
 
 	void				add(Listener& listener);
 	void				remove(Listener& listener);
 	Poco::UInt32		count();
 	
+	const std::string	name;
 	const Poco::UInt32	idPublisher;
 private:
 	std::list<Listener*>	_listeners;
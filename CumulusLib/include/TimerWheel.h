@@ -0,0 +1,91 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#pragma once
+
+#include "Cumulus.h"
+
+#define TIMERWHEEL_BITS		6
+#define TIMERWHEEL_SLOTS	(1<<TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS	4
+
+namespace Cumulus {
+
+class TimerWheel;
+// Intrusive entry of a timer wheel, it's unscheduled on deletion
+class Timer {
+	friend class TimerWheel;
+public:
+	Timer();
+	virtual ~Timer();
+
+	bool		scheduled() const;
+	TimerWheel*	wheel() const;
+
+private:
+	void		link(Timer& head);
+	void		unlink();
+
+	Timer*			_pPrev;
+	Timer*			_pNext;
+	Poco::UInt32	_expiry;
+	TimerWheel*		_pWheel;
+};
+
+// Hierarchical timing wheel (4 levels of 64 slots), the time unit is the tick.
+// Scheduling and cancelling are in O(1), and a tick touches only the expired timers
+// (plus rarely the cascade of one slot of an upper level)
+class TimerWheel {
+public:
+	TimerWheel();
+	virtual ~TimerWheel();
+
+	// Schedules (or reschedules) the timer to expire in 'ticks' ticks (at least 1)
+	void		schedule(Timer& timer,Poco::UInt32 ticks);
+	// Reschedules the timer only if it expires sooner like that
+	void		advance(Timer& timer,Poco::UInt32 ticks);
+	void		cancel(Timer& timer);
+
+	// Goes to the next tick, then pop returns the timers expired (NULL at the end)
+	void		tick();
+	Timer*		pop();
+
+	Poco::UInt32	now() const;
+
+private:
+	void		insert(Timer& timer);
+	void		cascade(Poco::UInt8 level);
+
+	Poco::UInt32	_now;
+	Timer			_slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+	Timer			_expired;
+};
+
+inline bool Timer::scheduled() const {
+	return _pNext!=this;
+}
+
+inline TimerWheel* Timer::wheel() const {
+	return _pWheel;
+}
+
+inline Poco::UInt32 TimerWheel::now() const {
+	return _now;
+}
+
+
+} // namespace Cumulus
@@ -31,11 +31,14 @@ public:
 	virtual ~Trigger();
 
 	bool raise();
-	void start();
+	// The first repeat waits at least 1.5 sec, or the retransmission timeout when it's longer
+	void start(Poco::Timestamp::TimeDiff timeout=0);
 	void reset();
 	void stop();
+	bool running() const;
 private:
 	Poco::Timestamp	_timeInit;
+	Poco::Timestamp::TimeDiff	_timeout;
 	Poco::Int8		_cycle;
 	Poco::UInt8		_time;
 	bool			_running;
@@ -46,5 +49,9 @@ inline void Trigger::stop() {
 	_running=false;
 }
 
+inline bool Trigger::running() const {
+	return _running;
+}
+
 
 } // namespace Cumulus
@@ -29,6 +29,9 @@ public:
 	static std::string FormatHex(const Poco::UInt8* data,unsigned size);
 	static Poco::UInt8 Get7BitValueSize(Poco::UInt32 value);
 	static void UnpackUrl(const std::string& url,std::string& path,std::map<std::string,std::string>& parameters);
+	// SipHash-2-4 with a random key drawn at the start of the process, for the hash indexes:
+	// the keys received from the network can't be chosen to collide in them
+	static Poco::UInt32 Hash(const Poco::UInt8* data,unsigned size);
 };
 
 } // namespace Cumulus
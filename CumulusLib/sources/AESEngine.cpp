@@ -17,28 +17,94 @@
 
 #include "AESEngine.h"
 #include <string.h>
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#include <cpuid.h>
+#endif
 
 using namespace Poco;
 
 namespace Cumulus {
 
-AESEngine::AESEngine(const UInt8* key,Direction direction) : _direction(direction) {
+AESEngine::Type AESEngine::s_default(AESEngine::HasAESNI() ? AESEngine::EVP : AESEngine::LEGACY);
+
+bool AESEngine::HasAESNI() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	int info[4];
+	__cpuid(info,1);
+	return (info[2]&(1<<25))!=0;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	unsigned int eax,ebx,ecx,edx;
+	if(!__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+		return false;
+	return (ecx&(1<<25))!=0;
+#else
+	return true;
+#endif
+}
+
+AESEngine::AESEngine(const UInt8* key,Direction direction,Type type) : _direction(direction),_type(type),_pContext(NULL) {
+	if(_type==EVP) {
+		UInt8 iv[16];
+		memset(iv,0,sizeof(iv));
+		_pContext = EVP_CIPHER_CTX_new();
+		EVP_CipherInit_ex(_pContext,EVP_aes_128_cbc(),NULL,key,iv,_direction);
+		EVP_CIPHER_CTX_set_padding(_pContext,0);
+		return;
+	}
 	if(_direction==DECRYPT)
 		AES_set_decrypt_key(key, 128,&_key);
 	else
 		AES_set_encrypt_key(key, 128,&_key);
 }
 
+AESEngine::AESEngine(const AESEngine& other) : _direction(other._direction),_type(other._type),_key(other._key),_pContext(NULL) {
+	if(other._pContext) {
+		_pContext = EVP_CIPHER_CTX_new();
+		EVP_CIPHER_CTX_copy(_pContext,other._pContext);
+	}
+}
+
 
 AESEngine::~AESEngine() {
+	if(_pContext)
+		EVP_CIPHER_CTX_free(_pContext);
 }
 
 void AESEngine::process(const UInt8* in,UInt8* out,unsigned int size) {
-	UInt8	iv[128];
+	if(_pContext) {
+		// just the IV is reset, the expanded key stays in the context
+		static const UInt8 IV[16] = {0};
+		int length = 0;
+		EVP_CipherInit_ex(_pContext,NULL,NULL,NULL,IV,-1);
+		EVP_CipherUpdate(_pContext,out,&length,in,size);
+		return;
+	}
+	UInt8	iv[AES_BLOCK_SIZE];
 	memset(iv,0,sizeof(iv));
 	AES_cbc_encrypt(in, out,size,&_key,iv, _direction);
 }
 
+void AESEngine::process(const UInt8* in,UInt8* out,unsigned int size,UInt8* iv) {
+	if(!_pContext) {
+		AES_cbc_encrypt(in, out,size,&_key,iv, _direction);
+		return;
+	}
+	int length = 0;
+	EVP_CipherInit_ex(_pContext,NULL,NULL,NULL,iv,-1);
+	if(size<AES_BLOCK_SIZE) {
+		EVP_CipherUpdate(_pContext,out,&length,in,size);
+		return;
+	}
+	// the next IV is the last crypted block, to save before an in-place decryption
+	if(_direction==DECRYPT)
+		memcpy(iv,in+(size&~(AES_BLOCK_SIZE-1))-AES_BLOCK_SIZE,AES_BLOCK_SIZE);
+	EVP_CipherUpdate(_pContext,out,&length,in,size);
+	if(_direction==ENCRYPT)
+		memcpy(iv,out+(size&~(AES_BLOCK_SIZE-1))-AES_BLOCK_SIZE,AES_BLOCK_SIZE);
+}
+
 
 
 
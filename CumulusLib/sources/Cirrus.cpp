@@ -27,7 +27,7 @@ using namespace Net;
 
 namespace Cumulus {
 
-Cirrus::Cirrus(const SocketAddress& address,Sessions& sessions) : _sessions(sessions),_address(address) {
+Cirrus::Cirrus(const SocketAddress& address) : _address(address) {
 	if(_address.port()==0)
 		_address = SocketAddress(_address.host(),RTMFP_DEFAULT_PORT);
 }
@@ -38,13 +38,17 @@ Cirrus::~Cirrus() {
 
 
 const Middle* Cirrus::findMiddle(const UInt8* peerId) {
-	Sessions::Iterator it;
-	for(it=_sessions.begin();it!=_sessions.end();++it) {
-		Middle* pMiddle = (Middle*)it->second;
-		if(pMiddle->middlePeer() == peerId)
-			return pMiddle;
-	}
-	return NULL;
+	return _middles.find(peerId);
+}
+
+void Cirrus::addMiddle(Middle& middle) {
+	_middles.set(middle.middlePeer().id,&middle);
+}
+
+void Cirrus::removeMiddle(Middle& middle) {
+	PeerIdKey key(middle.middlePeer().id);
+	if(_middles.find(key)==&middle)
+		_middles.erase(key);
 }
 
 
@@ -22,7 +22,7 @@ using namespace Poco;
 
 namespace Cumulus {
 
-Client::Client():id(),state(NONE) {
+Client::Client():id(),state(NONE),ping(0),pingVariance(0) {
 }
 
 Client::~Client() {
@@ -16,20 +16,144 @@
 */
 
 #include "Cookie.h"
-
+#include "Util.h"
+#include <string.h>
 
 using namespace std;
+using namespace Poco;
 
 namespace Cumulus {
 
-Cookie::Cookie(const string& queryUrl) : queryUrl(queryUrl) {
-	
+Cookie::Cookie() : created(0),used(false),consumed(false) {
+	memset(value,0,sizeof(value));
 }
 
-
 Cookie::~Cookie() {
 }
 
+CookieKey::CookieKey() : _hash(0) {
+	memset(_value,0,sizeof(_value));
+}
+
+CookieKey::CookieKey(const UInt8* value) {
+	memcpy(_value,value,sizeof(_value));
+	// the searched cookies come from the network
+	_hash = Util::Hash(_value,sizeof(_value));
+}
+
+UInt32 CookieKey::hash() const {
+	return _hash;
+}
+
+bool CookieKey::operator==(const CookieKey& other) const {
+	return _hash==other._hash && memcmp(_value,other._value,sizeof(_value))==0;
+}
+
+
+Cookies::Cookies(UInt32 capacity) : _cookies(capacity==0 ? 1 : capacity),_oldest(0),_count(0),_used(0) {
+}
+
+Cookies::~Cookies() {
+}
+
+const Cookie& Cookies::add(const UInt8* value,const string& queryUrl,Timestamp::TimeVal now) {
+	// a duplicate keeps its slot, else the pop of a second one would erase the index of the first
+	Cookie* pCookie = find(value);
+	if(pCookie)
+		return *pCookie;
+	if(_count==_cookies.size()) {
+		// replaces the oldest
+		pop();
+	}
+	Cookie& cookie = _cookies[(_oldest+_count)%_cookies.size()];
+	++_count;
+	memcpy(cookie.value,value,sizeof(cookie.value));
+	cookie.queryUrl.assign(queryUrl);
+	cookie.created = now;
+	cookie.used = true;
+	cookie.consumed = false;
+	++_used;
+	_index.set(CookieKey(value),&cookie);
+	return cookie;
+}
+
+void Cookies::remove(Cookie& cookie) {
+	if(!cookie.used)
+		return;
+	// a hole which will be removed of the ring when it will be the oldest
+	_index.erase(CookieKey(cookie.value));
+	cookie.used = false;
+	cookie.queryUrl.clear();
+	--_used;
+}
+
+void Cookies::pop() {
+	remove(_cookies[_oldest]);
+	_oldest = (_oldest+1)%_cookies.size();
+	--_count;
+}
+
+void Cookies::expire(Timestamp::TimeVal now) {
+	while(_count>0) {
+		const Cookie& cookie = _cookies[_oldest];
+		if(cookie.used && (now-cookie.created)<COOKIE_TIMEOUT)
+			break;
+		pop();
+	}
+}
+
+void Cookies::clear() {
+	while(_count>0)
+		pop();
+}
+
+
+SignatureKey::SignatureKey() : _hash(0) {
+	memset(_value,0,sizeof(_value));
+}
+
+SignatureKey::SignatureKey(const UInt8* signature) {
+	memcpy(_value,signature,sizeof(_value));
+	_hash = Util::Hash(_value,sizeof(_value));
+}
+
+UInt32 SignatureKey::hash() const {
+	return _hash;
+}
+
+bool SignatureKey::operator==(const SignatureKey& other) const {
+	return _hash==other._hash && memcmp(_value,other._value,sizeof(_value))==0;
+}
+
+
+ConsumedCookies::ConsumedCookies() {
+}
+
+ConsumedCookies::~ConsumedCookies() {
+}
+
+void ConsumedCookies::add(const UInt8* signature,Timestamp::TimeVal expiration) {
+	SignatureKey key(signature);
+	if(_index.find(key))
+		return;
+	_consumed.push_back(Consumed(signature,expiration));
+	_index.set(key,true);
+}
+
+void ConsumedCookies::expire(Timestamp::TimeVal now) {
+	// the expirations follow nearly the consumption order, a late one waits only its predecessors
+	while(!_consumed.empty() && _consumed.front().expiration<=now) {
+		_index.erase(_consumed.front().key);
+		_consumed.pop_front();
+	}
+}
+
+void ConsumedCookies::clear() {
+	while(!_consumed.empty()) {
+		_index.erase(_consumed.front().key);
+		_consumed.pop_front();
+	}
+}
 
 
 } // namespace Cumulus
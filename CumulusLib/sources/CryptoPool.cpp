@@ -0,0 +1,88 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "CryptoPool.h"
+#include "Logs.h"
+#include "Poco/Format.h"
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+CryptoPool::CryptoPool(UInt8 threads) : _terminate(false) {
+	for(UInt8 i=0;i<threads;++i) {
+		Thread* pThread = new Thread(format("Crypto %hu",(UInt16)i));
+		_threads.push_back(pThread);
+		pThread->start(*this);
+	}
+	DEBUG("%hu cryptographic threads started",(UInt16)threads);
+}
+
+CryptoPool::~CryptoPool() {
+	stop();
+}
+
+void CryptoPool::push(CryptoJob* pJob) {
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_jobs.push_back(pJob);
+	}
+	_event.set();
+}
+
+void CryptoPool::stop() {
+	_terminate = true;
+	vector<Thread*>::const_iterator it;
+	for(it=_threads.begin();it!=_threads.end();++it) {
+		_event.set();
+		(*it)->join();
+		delete *it;
+	}
+	_threads.clear();
+	ScopedLock<FastMutex> lock(_mutex);
+	_jobs.clear();
+}
+
+void CryptoPool::run() {
+	SetThreadName("Crypto");
+	while(!_terminate) {
+		CryptoJob* pJob = NULL;
+		bool others = false;
+		{
+			ScopedLock<FastMutex> lock(_mutex);
+			if(!_jobs.empty()) {
+				pJob = _jobs.front();
+				_jobs.pop_front();
+				others = !_jobs.empty();
+			}
+		}
+		if(!pJob) {
+			_event.wait();
+			continue;
+		}
+		// the event is auto-reset, it wakes up an other thread for the following jobs
+		if(others)
+			_event.set();
+		pJob->process();
+	}
+	// wake up the next thread to stop
+	_event.set();
+}
+
+
+} // namespace Cumulus
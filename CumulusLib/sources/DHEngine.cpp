@@ -0,0 +1,164 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "DHEngine.h"
+#include <string.h>
+
+using namespace Poco;
+
+namespace Cumulus {
+
+#define DH_WINDOW_BITS		4
+#define DH_WINDOW_VALUES	(1<<DH_WINDOW_BITS)
+#define DH_WINDOWS			(DH_KEY_SIZE*8/DH_WINDOW_BITS)
+#define DH_WORDS			(DH_KEY_SIZE/sizeof(UInt32))
+
+static const UInt8 g_dh1024p[] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xC9, 0x0F, 0xDA, 0xA2, 0x21, 0x68, 0xC2, 0x34,
+	0xC4, 0xC6, 0x62, 0x8B, 0x80, 0xDC, 0x1C, 0xD1,
+	0x29, 0x02, 0x4E, 0x08, 0x8A, 0x67, 0xCC, 0x74,
+	0x02, 0x0B, 0xBE, 0xA6, 0x3B, 0x13, 0x9B, 0x22,
+	0x51, 0x4A, 0x08, 0x79, 0x8E, 0x34, 0x04, 0xDD,
+	0xEF, 0x95, 0x19, 0xB3, 0xCD, 0x3A, 0x43, 0x1B,
+	0x30, 0x2B, 0x0A, 0x6D, 0xF2, 0x5F, 0x14, 0x37,
+	0x4F, 0xE1, 0x35, 0x6D, 0x6D, 0x51, 0xC2, 0x45,
+	0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6,
+	0xF4, 0x4C, 0x42, 0xE9, 0xA6, 0x37, 0xED, 0x6B,
+	0x0B, 0xFF, 0x5C, 0xB6, 0xF4, 0x06, 0xB7, 0xED,
+	0xEE, 0x38, 0x6B, 0xFB, 0x5A, 0x89, 0x9F, 0xA5,
+	0xAE, 0x9F, 0x24, 0x11, 0x7C, 0x4B, 0x1F, 0xE6,
+	0x49, 0x28, 0x66, 0x51, 0xEC, 0xE6, 0x53, 0x81,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static void ToBinary(const BIGNUM* pNumber,UInt8* out) {
+	int size = BN_num_bytes(pNumber);
+	memset(out,0,DH_KEY_SIZE-size);
+	BN_bn2bin(pNumber,out+DH_KEY_SIZE-size);
+}
+
+// The group, built once at the loading
+class DHGroup {
+public:
+	DHGroup() : pPrime(BN_bin2bn(g_dh1024p,sizeof(g_dh1024p),NULL)),pPrimeMinus1(BN_dup(pPrime)),pMontgomery(BN_MONT_CTX_new()) {
+		BN_sub_word(pPrimeMinus1,1);
+		BN_CTX* pContext = BN_CTX_new();
+		BN_MONT_CTX_set(pMontgomery,pPrime,pContext);
+
+		// powers[window][value] = 2^(value*16^window) in the Montgomery form
+		BIGNUM* pBase = BN_new();
+		BIGNUM* pPower = BN_new();
+		BN_set_word(pBase,2);
+		BN_to_montgomery(pBase,pBase,pMontgomery,pContext);
+		for(int window=0;window<DH_WINDOWS;++window) {
+			BN_one(pPower);
+			BN_to_montgomery(pPower,pPower,pMontgomery,pContext);
+			for(int value=0;value<DH_WINDOW_VALUES;++value) {
+				ToBinary(pPower,(UInt8*)powers[window][value]);
+				BN_mod_mul_montgomery(pPower,pPower,pBase,pMontgomery,pContext);
+			}
+			// base of the next window: base^16
+			for(int i=0;i<DH_WINDOW_BITS;++i)
+				BN_mod_mul_montgomery(pBase,pBase,pBase,pMontgomery,pContext);
+		}
+		BN_free(pPower);
+		BN_free(pBase);
+		BN_CTX_free(pContext);
+	}
+	~DHGroup() {
+		BN_MONT_CTX_free(pMontgomery);
+		BN_free(pPrimeMinus1);
+		BN_free(pPrime);
+	}
+
+	// Copies powers[window][value] without branch nor memory access depending on the value
+	void power(int window,UInt32 value,UInt32* out) const {
+		memset(out,0,DH_KEY_SIZE);
+		for(UInt32 i=0;i<DH_WINDOW_VALUES;++i) {
+			UInt32 mask = 0-(((i^value)-1)>>31); // 0xFFFFFFFF if i==value, 0 otherwise
+			const UInt32* entry = powers[window][i];
+			for(UInt32 j=0;j<DH_WORDS;++j)
+				out[j] |= entry[j]&mask;
+		}
+	}
+
+	BIGNUM*			pPrime;
+	BIGNUM*			pPrimeMinus1;
+	BN_MONT_CTX*	pMontgomery;
+	// Big endian bytes, in 32 bits words for the copy in constant time (512 KB)
+	UInt32			powers[DH_WINDOWS][DH_WINDOW_VALUES][DH_WORDS];
+};
+
+static DHGroup g_group;
+
+
+DHEngine::DHEngine() : _pPrivateKey(BN_new()) {
+	// private key of the length given by OpenSSL to this group (bits of the prime - 1)
+	BN_rand(_pPrivateKey,DH_KEY_SIZE*8-1,0,0);
+	UInt8 exponent[DH_KEY_SIZE];
+	ToBinary(_pPrivateKey,exponent);
+
+	// public key = 2^privateKey = product of 2^(window value*16^window)
+	BN_CTX* pContext = BN_CTX_new();
+	BIGNUM* pResult = BN_new();
+	BIGNUM* pPower = BN_new();
+	BN_one(pResult);
+	BN_to_montgomery(pResult,pResult,g_group.pMontgomery,pContext);
+	UInt32 power[DH_WORDS];
+	for(int window=0;window<DH_WINDOWS;++window) {
+		UInt8 byte = exponent[DH_KEY_SIZE-1-window/2];
+		g_group.power(window,window&1 ? byte>>4 : byte&0x0F,power);
+		BN_bin2bn((const UInt8*)power,DH_KEY_SIZE,pPower);
+		BN_mod_mul_montgomery(pResult,pResult,pPower,g_group.pMontgomery,pContext);
+	}
+	BN_from_montgomery(pResult,pResult,g_group.pMontgomery,pContext);
+	ToBinary(pResult,_publicKey);
+
+	memset(exponent,0,sizeof(exponent));
+	memset(power,0,sizeof(power));
+	BN_clear_free(pPower);
+	BN_free(pResult);
+	BN_CTX_free(pContext);
+}
+
+DHEngine::~DHEngine() {
+	BN_clear_free(_pPrivateKey);
+}
+
+bool DHEngine::computeSecret(const UInt8* farPubKey,UInt8* sharedSecret) const {
+	BIGNUM* pFarPubKey = BN_bin2bn(farPubKey,DH_KEY_SIZE,NULL);
+	// 1 < farPubKey < prime-1, as DH_compute_key checks
+	bool valid = BN_cmp(pFarPubKey,BN_value_one())>0 && BN_cmp(pFarPubKey,g_group.pPrimeMinus1)<0;
+	if(valid) {
+		BN_CTX* pContext = BN_CTX_new();
+		BIGNUM* pSecret = BN_new();
+		BIGNUM* pExponent = BN_dup(_pPrivateKey);
+		BN_set_flags(pExponent,BN_FLG_CONSTTIME);
+		valid = BN_mod_exp_mont_consttime(pSecret,pFarPubKey,pExponent,g_group.pPrime,pContext,g_group.pMontgomery)==1;
+		if(valid)
+			ToBinary(pSecret,sharedSecret);
+		BN_clear_free(pExponent);
+		BN_clear_free(pSecret);
+		BN_CTX_free(pContext);
+	}
+	BN_free(pFarPubKey);
+	return valid;
+}
+
+
+} // namespace Cumulus
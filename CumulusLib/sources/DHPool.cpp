@@ -0,0 +1,113 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "DHPool.h"
+#include "RTMFP.h"
+#include "Logs.h"
+#include "Poco/Format.h"
+#include <string.h>
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+DHPool::DHPool(UInt16 depth,UInt8 threads) : _depth(depth),_terminate(false),_acquired(0),_misses(0) {
+	if(threads==0)
+		threads = 1;
+	for(UInt8 i=0;i<threads;++i) {
+		Thread* pThread = new Thread(format("DH %hu",(UInt16)i));
+		_threads.push_back(pThread);
+		pThread->start(*this);
+	}
+	DEBUG("Diffie-Hellman pool of %hu keypairs filled by %hu thread(s)",_depth,(UInt16)threads);
+}
+
+DHPool::~DHPool() {
+	stop();
+	deque<DHEngine*>::const_iterator it;
+	for(it=_keyPairs.begin();it!=_keyPairs.end();++it)
+		delete *it;
+}
+
+void DHPool::stats(DHPoolStats& stats) {
+	ScopedLock<FastMutex> lock(_mutex);
+	stats.ready = _keyPairs.size();
+	stats.depth = _depth;
+	stats.acquired = _acquired;
+	stats.misses = _misses;
+}
+
+DHEngine* DHPool::acquire(UInt8* pubKey) {
+	DHEngine* pDH = NULL;
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		++_acquired;
+		if(_keyPairs.empty())
+			++_misses;
+		else {
+			pDH = _keyPairs.front();
+			_keyPairs.pop_front();
+		}
+	}
+	// refill
+	_event.set();
+	if(pDH) {
+		memcpy(pubKey,pDH->publicKey(),DH_KEY_SIZE);
+		return pDH;
+	}
+	DEBUG("Diffie-Hellman pool empty, keypair generated during the handshake");
+	return RTMFP::BeginDiffieHellman(pubKey);
+}
+
+void DHPool::stop() {
+	_terminate = true;
+	vector<Thread*>::const_iterator it;
+	for(it=_threads.begin();it!=_threads.end();++it) {
+		_event.set();
+		(*it)->join();
+		delete *it;
+	}
+	_threads.clear();
+}
+
+void DHPool::run() {
+	SetThreadName("DH");
+	while(!_terminate) {
+		bool full;
+		{
+			ScopedLock<FastMutex> lock(_mutex);
+			full = _keyPairs.size()>=_depth;
+		}
+		if(full) {
+			_event.wait();
+			continue;
+		}
+		// the generation is done without lock, several threads can fill the pool in the same time
+		DHEngine* pDH = new DHEngine();
+		ScopedLock<FastMutex> lock(_mutex);
+		_keyPairs.push_back(pDH);
+		// wakes up an other thread for the following keypairs
+		if(_keyPairs.size()<_depth)
+			_event.set();
+	}
+	// wake up the next thread to stop
+	_event.set();
+}
+
+
+} // namespace Cumulus
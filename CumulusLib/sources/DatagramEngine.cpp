@@ -0,0 +1,451 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "DatagramEngine.h"
+#include "IOUring.h"
+#include "Logs.h"
+#include "Poco/Format.h"
+#include "Poco/Net/NetException.h"
+#include "string.h"
+#if defined(__linux__)
+	#include <sys/socket.h>
+	#include <errno.h>
+	#include <stdint.h>
+#endif
+
+// Buffer of the ring mode: io_uring_recvmsg_out header, sender address, and payload
+#define RING_BUFFER_SIZE	(((16+sizeof(sockaddr_storage)+PACKETRECV_SIZE)+63)&~63)
+#define RING_GROUP			0
+
+using namespace std;
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace Cumulus {
+
+DatagramEngine::DatagramEngine(DatagramSocket& socket,PacketPool& pool) : _socket(socket),_pool(pool),_batchSize(0),_sizes(1),_senders(1),
+	_pRecvMsgs(NULL),_pRecvVecs(NULL),_pRecvAddresses(NULL),_sendBuffers(NULL),_sendFirst(0),_sendCount(0),_pSendMsgs(NULL),_pSendVecs(NULL),_pSendAddresses(NULL),
+	_pRecvRing(NULL),_pSendRing(NULL),_ringBuffers(NULL),_ringArmed(false),_pRingMsg(NULL) {
+	_sendPending[0] = _sendPending[1] = 0;
+	slots(1);
+}
+
+DatagramEngine::~DatagramEngine() {
+	close();
+	slots(0);
+}
+
+void DatagramEngine::slots(UInt16 count) {
+	vector<PacketBuffer*>::const_iterator it;
+	for(it=_slots.begin();it!=_slots.end();++it)
+		(*it)->release();
+	_slots.resize(count);
+	_packets.resize(count>0 ? count : 1);
+	for(UInt16 i=0;i<count;++i) {
+		_slots[i] = _pool.acquire();
+		_packets[i] = _slots[i]->data();
+	}
+}
+
+PacketBuffer* DatagramEngine::take(int index) {
+	PacketBuffer* pBuffer = _pool.acquire();
+	if(ring()) {
+		// the ring buffers belong to the kernel
+		memcpy(pBuffer->data(),_packets[index],_sizes[index]);
+		return pBuffer;
+	}
+	PacketBuffer* pTaken = _slots[index];
+	_slots[index] = pBuffer;
+	_packets[index] = pBuffer->data();
+#if defined(__linux__)
+	if(_pRecvVecs)
+		_pRecvVecs[index].iov_base = _packets[index];
+#endif
+	return pTaken;
+}
+
+void DatagramEngine::open(UInt16 batchSize,bool uring) {
+	close();
+	if(batchSize>DATAGRAM_MAX_BATCH)
+		batchSize = DATAGRAM_MAX_BATCH;
+#if defined(__linux__)
+	if(uring && batchSize<=1)
+		batchSize = DATAGRAM_URING_BATCH;
+	if(batchSize<=1)
+		return;
+	_batchSize = batchSize;
+
+	_sizes.resize(_batchSize);
+	_senders.resize(_batchSize);
+
+	// two halves for the ring mode, the batch mode uses only the first one
+	_sendBuffers = new UInt8[_batchSize*2*PACKETSEND_SIZE];
+	_pSendMsgs = new mmsghdr[_batchSize*2];
+	_pSendVecs = new iovec[_batchSize*2];
+	_pSendAddresses = new sockaddr_storage[_batchSize*2];
+	memset(_pSendMsgs,0,sizeof(mmsghdr)*_batchSize*2);
+	for(int i=0;i<_batchSize*2;++i) {
+		_pSendVecs[i].iov_base = &_sendBuffers[i*PACKETSEND_SIZE];
+		_pSendMsgs[i].msg_hdr.msg_iov = &_pSendVecs[i];
+		_pSendMsgs[i].msg_hdr.msg_iovlen = 1;
+		_pSendMsgs[i].msg_hdr.msg_name = &_pSendAddresses[i];
+	}
+
+	if(uring && openRing()) {
+		slots(0);
+		_packets.resize(_batchSize);
+		DEBUG("Datagram engine in ring mode (io_uring), %hu datagrams by reception",_batchSize);
+		return;
+	}
+
+	slots(_batchSize);
+	_pRecvMsgs = new mmsghdr[_batchSize];
+	_pRecvVecs = new iovec[_batchSize];
+	_pRecvAddresses = new sockaddr_storage[_batchSize];
+
+	memset(_pRecvMsgs,0,sizeof(mmsghdr)*_batchSize);
+	for(int i=0;i<_batchSize;++i) {
+		_pRecvVecs[i].iov_base = packet(i);
+		_pRecvMsgs[i].msg_hdr.msg_iov = &_pRecvVecs[i];
+		_pRecvMsgs[i].msg_hdr.msg_iovlen = 1;
+		_pRecvMsgs[i].msg_hdr.msg_name = &_pRecvAddresses[i];
+	}
+	DEBUG("Datagram engine in batch mode, %hu datagrams by system call",_batchSize);
+#else
+	if(batchSize>1 || uring)
+		WARN("Datagram batch and ring modes unsupported on this platform, classic mode used");
+#endif
+}
+
+void DatagramEngine::close() {
+	if(!batched())
+		return;
+	flush();
+	if(ring()) {
+		// the kernel reads the sending buffers until the completions
+		reapRing(0);
+		reapRing(1);
+	}
+	closeRing();
+#if defined(__linux__)
+	delete [] _pRecvMsgs;
+	delete [] _pRecvVecs;
+	delete [] _pRecvAddresses;
+	delete [] _sendBuffers;
+	delete [] _pSendMsgs;
+	delete [] _pSendVecs;
+	delete [] _pSendAddresses;
+#endif
+	_pRecvMsgs = NULL;_pRecvVecs = NULL;_pRecvAddresses = NULL;
+	_sendBuffers = NULL;_pSendMsgs = NULL;_pSendVecs = NULL;_pSendAddresses = NULL;
+	_batchSize = 0;
+	_sendFirst = _sendCount = 0;
+	_sendPending[0] = _sendPending[1] = 0;
+	slots(1);
+	_sizes.resize(1);
+	_senders.resize(1);
+}
+
+bool DatagramEngine::openRing() {
+#if defined(CUMULUS_URING)
+	// enough buffers for the datagrams waiting their processing and the next receptions
+	UInt16 count = 1;
+	while(count<_batchSize*4)
+		count <<= 1;
+	_ringBuffers = new UInt8[count*RING_BUFFER_SIZE];
+	_pRingMsg = new msghdr();
+	memset(_pRingMsg,0,sizeof(msghdr));
+	_pRingMsg->msg_namelen = sizeof(sockaddr_storage);
+	_ringUsed.reserve(_batchSize);
+
+	_pRecvRing = new IOUring();
+	_pSendRing = new IOUring();
+	int error = _pRecvRing->open(4,count*2);
+	if(error==0)
+		error = _pRecvRing->registerBuffers(RING_GROUP,_ringBuffers,RING_BUFFER_SIZE,count);
+	if(error==0)
+		error = _pSendRing->open(_batchSize*2,_batchSize*2);
+	if(error==0) {
+		// an old kernel rejects the multishot reception immediately
+		armRing();
+		io_uring_cqe* pCQE = _pRecvRing->cqe();
+		if(pCQE && pCQE->res<0 && !(pCQE->flags&IORING_CQE_F_MORE))
+			error = pCQE->res;
+	}
+	if(error==0)
+		return true;
+	WARN("io_uring unavailable (%s), datagram engine falls back in batch mode",strerror(-error));
+	closeRing();
+#endif
+	return false;
+}
+
+void DatagramEngine::closeRing() {
+	if(_pRecvRing)
+		delete _pRecvRing;
+	if(_pSendRing)
+		delete _pSendRing;
+	if(_ringBuffers)
+		delete [] _ringBuffers;
+	if(_pRingMsg)
+		delete _pRingMsg;
+	_pRecvRing = _pSendRing = NULL;
+	_ringBuffers = NULL;
+	_pRingMsg = NULL;
+	_ringUsed.clear();
+	_ringArmed = false;
+}
+
+void DatagramEngine::armRing() {
+#if defined(CUMULUS_URING)
+	io_uring_sqe* pSQE = _pRecvRing->sqe();
+	if(!pSQE)
+		return;
+	pSQE->opcode = IORING_OP_RECVMSG;
+	pSQE->fd = _socket.impl()->sockfd();
+	pSQE->addr = (UInt64)(uintptr_t)_pRingMsg;
+	pSQE->ioprio = IORING_RECV_MULTISHOT;
+	pSQE->flags = IOSQE_BUFFER_SELECT;
+	pSQE->buf_group = RING_GROUP;
+	int result = _pRecvRing->submit();
+	if(result<0) {
+		ERROR("io_uring submission error %d : %s",-result,strerror(-result));
+		return;
+	}
+	_ringArmed = true;
+#endif
+}
+
+int DatagramEngine::ringFd() const {
+#if defined(CUMULUS_URING)
+	if(_pRecvRing)
+		return _pRecvRing->fd();
+#endif
+	return -1;
+}
+
+int DatagramEngine::receiveRing() {
+	int count = 0;
+#if defined(CUMULUS_URING)
+	// the datagrams of the previous reception have been processed, their buffers return to the kernel
+	vector<UInt16>::const_iterator it;
+	for(it=_ringUsed.begin();it!=_ringUsed.end();++it)
+		_pRecvRing->recycle(*it);
+	if(!_ringUsed.empty())
+		_pRecvRing->commitBuffers();
+	_ringUsed.clear();
+
+	io_uring_cqe* pCQE;
+	while(count<_batchSize && (pCQE=_pRecvRing->cqe())) {
+		int result = pCQE->res;
+		UInt32 flags = pCQE->flags;
+		_pRecvRing->seen();
+		if(!(flags&IORING_CQE_F_MORE))
+			_ringArmed = false;
+		if(flags&IORING_CQE_F_BUFFER)
+			_ringUsed.push_back(flags>>IORING_CQE_BUFFER_SHIFT);
+		if(result<0) {
+			// ENOBUFS: all the buffers are in process, the reception is armed again after their recycling
+			if(result!=-ENOBUFS)
+				ERROR("io_uring reception error %d : %s",-result,strerror(-result));
+			continue;
+		}
+		if(!(flags&IORING_CQE_F_BUFFER))
+			continue;
+		io_uring_recvmsg_out* pOut = (io_uring_recvmsg_out*)_pRecvRing->buffer(flags>>IORING_CQE_BUFFER_SHIFT);
+		if(pOut->flags&MSG_TRUNC) {
+			WARN("Datagram truncated, more than %u bytes",PACKETRECV_SIZE);
+			continue;
+		}
+		UInt8* pName = (UInt8*)(pOut+1);
+		_packets[count] = pName+sizeof(sockaddr_storage);
+		_sizes[count] = pOut->payloadlen;
+		_senders[count] = SocketAddress((const sockaddr*)pName,pOut->namelen);
+		++count;
+	}
+
+	// If no buffer is free, the kernel answers ENOBUFS at once and the next reception recycles them
+	if(!_ringArmed)
+		armRing();
+#endif
+	return count;
+}
+
+int DatagramEngine::receive(const Timespan& timeout) {
+	if (!_socket.poll(timeout, Socket::SELECT_READ))
+		return 0;
+	return receive();
+}
+
+int DatagramEngine::receive() {
+	if(ring())
+		return receiveRing();
+	if(batched())
+		return receiveBatch();
+	return receiveClassic();
+}
+
+int DatagramEngine::receiveClassic() {
+	_sizes[0] = _socket.receiveFrom(packet(0),PACKETRECV_SIZE,_senders[0]);
+	return 1;
+}
+
+int DatagramEngine::receiveBatch() {
+#if defined(__linux__)
+	for(int i=0;i<_batchSize;++i) {
+		_pRecvVecs[i].iov_len = PACKETRECV_SIZE;
+		_pRecvMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+		_pRecvMsgs[i].msg_hdr.msg_flags = 0;
+	}
+	int count = recvmmsg(_socket.impl()->sockfd(),_pRecvMsgs,_batchSize,MSG_DONTWAIT,NULL);
+	if(count<0) {
+		if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+			return 0;
+		if(errno==ENOSYS) {
+			WARN("recvmmsg unsupported by this kernel, datagram engine falls back in classic mode");
+			open(0);
+			return receiveClassic();
+		}
+		throw NetException(format("recvmmsg error %d : %s",errno,string(strerror(errno))));
+	}
+	for(int i=0;i<count;++i) {
+		_sizes[i] = _pRecvMsgs[i].msg_len;
+		_senders[i] = SocketAddress((const sockaddr*)&_pRecvAddresses[i],_pRecvMsgs[i].msg_hdr.msg_namelen);
+	}
+	return count;
+#else
+	return receiveClassic();
+#endif
+}
+
+void DatagramEngine::send(const UInt8* data,int size,const SocketAddress& address) {
+	if(!batched() || size>PACKETSEND_SIZE) {
+		// the datagrams queued before go out first
+		flush();
+		sendClassic(data,size,address);
+		return;
+	}
+#if defined(__linux__)
+	if(_sendCount==_batchSize)
+		flush();
+	int index = _sendFirst+_sendCount;
+	memcpy(_pSendVecs[index].iov_base,data,size);
+	_pSendVecs[index].iov_len = size;
+	memcpy(&_pSendAddresses[index],address.addr(),address.length());
+	_pSendMsgs[index].msg_hdr.msg_namelen = address.length();
+	++_sendCount;
+#endif
+}
+
+void DatagramEngine::flush() {
+	if(ring()) {
+		flushRing();
+		return;
+	}
+#if defined(__linux__)
+	int sent = 0;
+	while(sent<_sendCount) {
+		int result = sendmmsg(_socket.impl()->sockfd(),&_pSendMsgs[sent],_sendCount-sent,0);
+		if(result<0) {
+			if(errno==EINTR)
+				continue;
+			// skip the datagram in error to send the following
+			ERROR("Socket send error : sendmmsg error %d (%s)",errno,strerror(errno));
+			result = 1;
+		}
+		sent += result;
+	}
+#endif
+	_sendCount = 0;
+}
+
+void DatagramEngine::flushRing() {
+#if defined(CUMULUS_URING)
+	reapRing();
+	if(_sendCount==0)
+		return;
+	UInt8 half = _sendFirst>0 ? 1 : 0;
+	int end = _sendFirst+_sendCount;
+	int prepared = 0;
+	while(_sendFirst+prepared<end) {
+		io_uring_sqe* pSQE = _pSendRing->sqe();
+		if(!pSQE)
+			break; // submission queue full, the rest is sent below by the classic path
+		int i = _sendFirst+prepared++;
+		pSQE->opcode = IORING_OP_SENDMSG;
+		pSQE->fd = _socket.impl()->sockfd();
+		pSQE->addr = (UInt64)(uintptr_t)&_pSendMsgs[i].msg_hdr;
+		pSQE->user_data = i;
+	}
+	// one system call to submit all the sendings, without waiting: the completions are reaped on the next flushes
+	int result = _pSendRing->submit();
+	if(result<0) {
+		ERROR("Socket send error : io_uring submission error %d (%s)",-result,strerror(-result));
+		result = 0;
+	}
+	// only the entries consumed by the kernel will have a completion, the others are withdrawn and sent now
+	_pSendRing->discard();
+	_sendPending[half] += result;
+	for(int i=_sendFirst+result;i<end;++i)
+		sendClassic((const UInt8*)_pSendVecs[i].iov_base,_pSendVecs[i].iov_len,SocketAddress((const sockaddr*)&_pSendAddresses[i],_pSendMsgs[i].msg_hdr.msg_namelen));
+	// the following sendings go in the other half, its sendings (the flush before) are usually completed already
+	half = half ? 0 : 1;
+	_sendFirst = half ? _batchSize : 0;
+	reapRing(half);
+#endif
+	_sendCount = 0;
+}
+
+void DatagramEngine::reapRing(int wait) {
+#if defined(CUMULUS_URING)
+	for(;;) {
+		io_uring_cqe* pCQE;
+		while((pCQE=_pSendRing->cqe())) {
+			if(pCQE->res<0)
+				ERROR("Socket send error : io_uring sendmsg error %d (%s)",-pCQE->res,strerror(-pCQE->res));
+			--_sendPending[pCQE->user_data<_batchSize ? 0 : 1];
+			_pSendRing->seen();
+		}
+		if(wait<0 || _sendPending[wait]==0)
+			return;
+		int result = _pSendRing->submit(_sendPending[wait]);
+		if(result<0) {
+			ERROR("Socket send error : io_uring completion error %d (%s)",-result,strerror(-result));
+			return;
+		}
+	}
+#endif
+}
+
+void DatagramEngine::sendClassic(const UInt8* data,int size,const SocketAddress& address) {
+	try {
+		// TODO remake? without retry (but flow)
+		bool retry=false;
+		while(_socket.sendTo(data,size,address)!=size) {
+			if(retry) {
+				ERROR("Socket send error : all data were not sent");
+				break;
+			}
+			retry = true;
+		}
+	} catch(Exception& ex) {
+		 CRITIC("Socket send error : %s",ex.displayText().c_str());
+	}
+}
+
+
+} // namespace Cumulus
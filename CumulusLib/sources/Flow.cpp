@@ -210,7 +210,10 @@ void Flow::flushMessages() {
 			continue;
 		}
 
-		_trigger.start();
+		if(!_trigger.running()) {
+			_trigger.start(peer.retransmissionTimeout());
+			_session.manageSoon(); // to raise the repeat trigger
+		}
 
 		message.startStage = _stageSnd;
 
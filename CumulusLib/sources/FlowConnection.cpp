@@ -18,6 +18,7 @@
 #include "FlowConnection.h"
 #include "FlowStream.h"
 #include "Logs.h"
+#include "Util.h"
 
 using namespace std;
 using namespace Poco;
@@ -43,6 +44,9 @@ void FlowConnection::messageHandler(const std::string& name,AMFReader& message)
 		message.readObject(obj);
 		((URI&)peer.swfUrl) = obj.getString("swfUrl","");
 		((URI&)peer.pageUrl) = obj.getString("pageUrl","");
+		// handshake with a stateless cookie, which doesn't keep the url
+		if(peer.path.empty())
+			Util::UnpackUrl(obj.getString("tcUrl",""),(string&)peer.path,(map<string,string>&)peer.parameters);
 
 		((Client::ClientState&)peer.state) = Client::REJECTED;
 
@@ -27,7 +27,7 @@ namespace Cumulus {
 string FlowGroup::s_signature("\x00\x47\x43",3);
 string FlowGroup::s_name("NetGroup");
 
-FlowGroup::FlowGroup(UInt8 id,Peer& peer,Session& session,ServerHandler& serverHandler) : Flow(id,s_signature,s_name,peer,session,serverHandler),_pGroup(NULL) {
+FlowGroup::FlowGroup(UInt8 id,Peer& peer,Session& session,ServerHandler& serverHandler) : Flow(id,s_signature,s_name,peer,session,serverHandler) {
 }
 
 FlowGroup::~FlowGroup() {
@@ -37,8 +37,12 @@ FlowGroup::~FlowGroup() {
 void FlowGroup::complete() {
 	// delete member of group
 	DEBUG("Group closed")
-	if(_pGroup)
-		_pGroup->removePeer(peer);
+	if(!_groupId.empty()) {
+		ScopedLock<FastMutex> lock(serverHandler.groupsMutex());
+		Group* pGroup = serverHandler.findGroup(_groupId);
+		if(pGroup)
+			pGroup->removePeer(peer);
+	}
 	Flow::complete();
 }
 
@@ -49,14 +53,25 @@ void FlowGroup::rawHandler(UInt8 type,PacketReader& data) {
 		if(data.available()>0) {
 			UInt32 size = data.read7BitValue();
 
-			vector<UInt8> groupId(size);
-			data.readRaw(&groupId[0],size);
+			_groupId.resize(size);
+			data.readRaw(&_groupId[0],size);
 
-			_pGroup = &serverHandler.group(groupId);
+			// the best peers can be owned by other workers, they are read with the groups locked
+			ScopedLock<FastMutex> lock(serverHandler.groupsMutex());
+			Group& group = serverHandler.group(_groupId);
 
-			_pGroup->bestPeers(_bestPeers,peer);
+			group.bestPeers(_bestPeers,peer);
 
-			_pGroup->addPeer(peer);
+			group.addPeer(peer);
+
+			// distribution of the introductions in this group (costs a walk of the members)
+			if(Logs::GetLevel()>=Logger::PRIO_DEBUG) {
+				IntroductionStats stats;
+				group.introductions(stats);
+				DEBUG("Group introductions : %u members, %u recent introductions (max %u), histogram 0:%u 1:%u 2-3:%u 4-7:%u 8-15:%u 16-31:%u 32-63:%u 64+:%u",
+					stats.members,stats.introductions,stats.max,stats.histogram[0],stats.histogram[1],stats.histogram[2],stats.histogram[3],
+					stats.histogram[4],stats.histogram[5],stats.histogram[6],stats.histogram[7]);
+			}
 			if(_bestPeers.empty())
 				return;
 
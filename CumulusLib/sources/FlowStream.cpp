@@ -16,6 +16,7 @@
 */
 
 #include "FlowStream.h"
+#include "Sessions.h"
 #include "Logs.h"
 
 using namespace std;
@@ -27,26 +28,27 @@ namespace Cumulus {
 string FlowStream::s_signature("\x00\x54\x43\x04",4);
 string FlowStream::s_name("NetStream");
 
-FlowStream::FlowStream(UInt8 id,const string& signature,Peer& peer,Session& session,ServerHandler& serverHandler) : Flow(id,_signature,s_name,peer,session,serverHandler),_signature(signature),_pSubscription(NULL),_state(IDLE) {
+FlowStream::FlowStream(UInt8 id,const string& signature,Peer& peer,Session& session,ServerHandler& serverHandler) : Flow(id,_signature,s_name,peer,session,serverHandler),Listener(SESSION_SHARD(session.id())),_signature(signature),_pSubscription(NULL),_state(IDLE) {
 	PacketReader reader((const UInt8*)signature.c_str(),signature.length());
 	reader.next(4);
 	_index = reader.read7BitValue();
 }
 
 FlowStream::~FlowStream() {
+	// a killed session doesn't complete its flows, the listener must leave its subscription before its deletion
+	if(_state==PUBLISHING)
+		serverHandler.streams.unpublish(_index,_name);
+	else if(_state==PLAYING)
+		serverHandler.streams.unsubscribe(_name,*this);
 }
 
 void FlowStream::audioHandler(PacketReader& packet) {
-	if(_pSubscription && _pSubscription->idPublisher == _index)
-		_pSubscription->pushAudioPacket(packet);
-	else
+	if(!_pSubscription || !serverHandler.streams.push(*_pSubscription,_index,0x08,packet,shard))
 		fail();
 }
 
 void FlowStream::videoHandler(PacketReader& packet) {
-	if(_pSubscription && _pSubscription->idPublisher == _index)
-		_pSubscription->pushVideoPacket(packet);
-	else
+	if(!_pSubscription || !serverHandler.streams.push(*_pSubscription,_index,0x09,packet,shard))
 		fail();
 }
 
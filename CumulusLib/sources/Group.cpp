@@ -16,15 +16,33 @@
 */
 
 #include "Group.h"
+#include "ServerHandler.h"
 #include "string.h"
 #include "Logs.h"
+#include "Util.h"
+#include <algorithm>
 
 using namespace std;
 using namespace Poco;
 
 namespace Cumulus {
 
-Group::Group(const vector<UInt8>& id) : _id(id) {
+GroupKey::GroupKey() : _hash(0) {
+}
+
+GroupKey::GroupKey(const vector<UInt8>& id) : _id(id),_hash(id.empty() ? 0 : Util::Hash(&id[0],id.size())) {
+}
+
+UInt32 GroupKey::hash() const {
+	return _hash;
+}
+
+bool GroupKey::operator==(const GroupKey& other) const {
+	return _hash==other._hash && _id==other._id;
+}
+
+
+Group::Group(const vector<UInt8>& id,ServerHandler& handler) : _id(id),_peers(handler.proximity),_handler(handler) {
 }
 
 Group::~Group() {
@@ -40,18 +58,20 @@ bool Group::operator!=(const std::vector<Poco::UInt8>& id) const {
 }
 
 void Group::addPeer(Peer& peer) {
-	if(!peer.isIn(*this)) {
-		peer._groups.push_back(this);
-		_peers.add(peer);
-	}
+	vector<Peer::Membership>::iterator it = lower_bound(peer._groups.begin(),peer._groups.end(),Peer::Membership(this));
+	if(it!=peer._groups.end() && it->pGroup==this)
+		return;
+	peer._groups.insert(it,Peer::Membership(this,_peers.add(peer,peer._rankedPing)));
 }
 
 void Group::removePeer(Peer& peer) {
-	list<Group*>::iterator itG;
-	if(peer.isIn(*this,itG)) {
-		peer._groups.erase(itG);
-		_peers.remove(peer);
-	}
+	vector<Peer::Membership>::iterator it = lower_bound(peer._groups.begin(),peer._groups.end(),Peer::Membership(this));
+	if(it==peer._groups.end() || it->pGroup!=this)
+		return;
+	_peers.remove(it->handle);
+	peer._groups.erase(it);
+	if(_peers.empty())
+		_handler.deleteGroup(*this); // deletes this!
 }
 
 } // namespace Cumulus
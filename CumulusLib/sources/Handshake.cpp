@@ -20,6 +20,7 @@
 #include "Util.h"
 #include "Poco/RandomStream.h"
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include "string.h"
 
 using namespace std;
@@ -28,31 +29,128 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-Handshake::Handshake(Gateway& gateway,DatagramSocket& socket,ServerHandler& serverHandler) : Session(0,0,Peer(SocketAddress()),RTMFP_SYMETRIC_KEY,RTMFP_SYMETRIC_KEY,socket,serverHandler),
-	_gateway(gateway),_signature("\x03\x1a\x00\x00\x02\x1e\x00\x81\x02\x0d\x02",11) {
+KeyExchange::KeyExchange(Gateway& gateway,DHPool* pDHPool,const string& cookie,UInt32 farId,const SocketAddress& address) :
+	cookie(cookie),farId(farId),address(address),exchanged(false),_gateway(gateway),_pDHPool(pDHPool) {
+}
+
+void KeyExchange::process() {
+	compute(signature);
+	_gateway.keyExchanged(this);
+}
+
+void KeyExchange::compute(const string& signature) {
+	// peerId = SHA256(farSignature+farPubKey)
+	string temp(farSignature);
+	temp.append((char*)farPubKey,sizeof(farPubKey));
+	EVP_Digest(temp.c_str(),temp.size(),peerId,NULL,EVP_sha256(),NULL);
 	
-	memcpy(_certificat,"\x01\x0A\x41\x0E",4);
-	RandomInputStream().read((char*)&_certificat[4],64);
-	memcpy(&_certificat[68],"\x02\x15\x02\x02\x15\x05\x02\x15\x0E",9);
+	// Compute Diffie-Hellman secret
+	UInt8 sharedSecret[DH_KEY_SIZE];
+	DHEngine* pDH = _pDHPool ? _pDHPool->acquire(pubKey) : RTMFP::BeginDiffieHellman(pubKey);
+	exchanged = RTMFP::EndDiffieHellman(pDH,farPubKey,sharedSecret);
+	if(!exchanged)
+		return;
+
+	// Compute Keys
+	RTMFP::ComputeAsymetricKeys(sharedSecret,pubKey,signature,farCertificat,requestKey,responseKey);
+}
 
-	// Display far id flash side
-	UInt8 id[32];
-	EVP_Digest(_certificat,sizeof(_certificat),id,NULL,EVP_sha256(),NULL);
 
-	INFO("Id of this cumulus server : %s",Util::FormatHex(id,32).c_str());
+Handshake::Handshake(Gateway& gateway,DatagramEngine& engine,ServerHandler& serverHandler,const UInt8* certificat,DHPool* pDHPool,CryptoPool* pCryptoPool,bool statelessCookies) : Session(0,0,Peer(SocketAddress()),RTMFP_SYMETRIC_KEY,RTMFP_SYMETRIC_KEY,engine,serverHandler),
+	_statelessCookies(statelessCookies),_now(Timestamp().epochMicroseconds()),_signature("\x03\x1a\x00\x00\x02\x1e\x00\x81\x02\x0d\x02",11),_gateway(gateway),_pDHPool(pDHPool),_pCryptoPool(pCryptoPool) {
+	
+	memcpy(_certificat,certificat,sizeof(_certificat));
+	RandomInputStream().read((char*)_cookieSecret,sizeof(_cookieSecret));
 }
 
 
 Handshake::~Handshake() {
 	clear();
+	map<string,KeyExchange*>::const_iterator it;
+	for(it=_keyExchanges.begin();it!=_keyExchanges.end();++it)
+		delete it->second;
 }
 
 void Handshake::clear() {
-	// delete cookies // TODO quand effacer les vieux cookies jamais utilis?
-	map<string,Cookie*>::const_iterator it;
-	for(it=_cookies.begin();it!=_cookies.end();++it)
-		delete it->second;
 	_cookies.clear();
+	_consumedCookies.clear();
+	_cookieResponses.clear();
+	_sessionResponses.clear();
+}
+
+void Handshake::manage() {
+	_now = Timestamp().epochMicroseconds();
+	_cookies.expire(_now);
+	_consumedCookies.expire(_now);
+	_cookieResponses.expire(_now);
+	_sessionResponses.expire(_now);
+}
+
+void Handshake::WriteAddress(const SocketAddress& address,UInt8* data) {
+	UInt8 size = address.host().length()>16 ? 16 : address.host().length();
+	memset(data,0,16);
+	memcpy(data,address.host().addr(),size);
+	data[16] = address.port()>>8;
+	data[17] = address.port()&0xFF;
+}
+
+UInt8 Handshake::ResponseKeyOf(const string& key,const SocketAddress& address,UInt8* value) {
+	UInt8 size = key.size()>RESPONSE_KEY_SIZE-18 ? RESPONSE_KEY_SIZE-18 : key.size();
+	memcpy(value,key.c_str(),size);
+	WriteAddress(address,value+size);
+	return size+18;
+}
+
+UInt8 Handshake::cachedResponse(const ResponseCache& cache,const string& key,const SocketAddress& address,PacketWriter& response) {
+	UInt8 value[RESPONSE_KEY_SIZE];
+	const CachedResponse* pResponse = cache.find(value,ResponseKeyOf(key,address,value));
+	if(!pResponse)
+		return 0;
+	response.writeRaw(pResponse->content);
+	return pResponse->id;
+}
+
+void Handshake::cacheResponse(ResponseCache& cache,const string& key,const SocketAddress& address,UInt8 idResponse,PacketWriter& response,int start) {
+	UInt8 value[RESPONSE_KEY_SIZE];
+	cache.add(value,ResponseKeyOf(key,address,value),idResponse,response.begin()+start,response.position()-start,_now);
+}
+
+void Handshake::createCookie(const string& epd,UInt8* cookie) {
+	UInt32 created = (UInt32)(_now/1000000);
+	cookie[0] = created>>24;
+	cookie[1] = (created>>16)&0xFF;
+	cookie[2] = (created>>8)&0xFF;
+	cookie[3] = created&0xFF;
+	RandomInputStream().read((char*)cookie+4,12);
+	UInt8 hash[32];
+	EVP_Digest(epd.c_str(),epd.size(),hash,NULL,EVP_sha256(),NULL);
+	memcpy(cookie+16,hash,16);
+	signCookie(cookie,peer().address,cookie+32);
+}
+
+Timestamp::TimeVal Handshake::CookieExpiration(const UInt8* cookie) {
+	UInt32 created = (cookie[0]<<24) | (cookie[1]<<16) | (cookie[2]<<8) | cookie[3];
+	// the creation time is in seconds
+	return ((Timestamp::TimeVal)created+COOKIE_STATELESS_TIMEOUT/1000000+1)*1000000;
+}
+
+bool Handshake::checkCookie(const UInt8* cookie) {
+	if(_now>=CookieExpiration(cookie))
+		return false;
+	UInt8 signature[32];
+	signCookie(cookie,peer().address,signature);
+	// comparison in constant time
+	UInt8 difference=0;
+	for(int i=0;i<32;++i)
+		difference |= signature[i]^cookie[32+i];
+	return difference==0;
+}
+
+void Handshake::signCookie(const UInt8* cookie,const SocketAddress& address,UInt8* signature) {
+	UInt8 data[32+16+2];
+	memcpy(data,cookie,32);
+	WriteAddress(address,data+32);
+	HMAC(EVP_sha256(),_cookieSecret,sizeof(_cookieSecret),data,sizeof(data),signature,NULL);
 }
 
 void Handshake::packetHandler(PacketReader& packet) {
@@ -76,6 +174,11 @@ void Handshake::packetHandler(PacketReader& packet) {
 			return;
 	}
 
+	send(idResponse);
+}
+
+void Handshake::send(UInt8 idResponse) {
+	PacketWriter& packetOut(writer());
 	packetOut << (UInt8)idResponse;
 	packetOut << (UInt16)(packetOut.length()-packetOut.position()-2);
 
@@ -86,6 +189,7 @@ void Handshake::packetHandler(PacketReader& packet) {
 
 
 UInt8 Handshake::handshakeHandler(UInt8 id,PacketReader& request,PacketWriter& response) {
+	int start = response.position();
 
 	switch(id){
 		case 0x30: {
@@ -101,30 +205,43 @@ UInt8 Handshake::handshakeHandler(UInt8 id,PacketReader& request,PacketWriter& r
 
 			string tag;
 			request.readRaw(16,tag);
-			response.writeString8(tag);
 
 			// UDP hole punching
 
-			if(type == 0x0f)
+			if(type == 0x0f) {
+				response.writeString8(tag);
 				return _gateway.p2pHandshake(tag,response,peer().address,(const UInt8*)epd.c_str());
+			}
 
 			if(type == 0x0a){
 				/// Handshake
+
+				// Retransmission
+				UInt8 idResponse = cachedResponse(_cookieResponses,tag,peer().address,response);
+				if(idResponse>0) {
+					DEBUG("Handshake 0x30 repeated, cached response");
+					return idResponse;
+				}
+
+				response.writeString8(tag);
 	
 				// RESPONSE 38
 
 				// New Cookie
-				char cookie[65];
-				RandomInputStream ris;
-				ris.read(cookie,64);
-				cookie[64]='\0';
-				response.write8(64);
-				response.writeRaw(cookie,64);
-				_cookies[cookie] = new Cookie(epd);
+				UInt8 cookie[COOKIE_SIZE];
+				if(_statelessCookies)
+					createCookie(epd,cookie);
+				else {
+					RandomInputStream().read((char*)cookie,COOKIE_SIZE);
+					_cookies.add(cookie,epd,_now);
+				}
+				response.write8(COOKIE_SIZE);
+				response.writeRaw(cookie,COOKIE_SIZE);
 				 
 				// instance id (certificat in the middle)
 				response.writeRaw(_certificat,sizeof(_certificat));
-				
+
+				cacheResponse(_cookieResponses,tag,peer().address,0x70,response,start);
 				return 0x70;
 			} else {
 				ERROR("Unkown handshake first way with '%02x' type",type);
@@ -136,52 +253,70 @@ UInt8 Handshake::handshakeHandler(UInt8 id,PacketReader& request,PacketWriter& r
 			string cookie;
 			request.readRaw(request.read8(),cookie);
 
-			map<string,Cookie*>::iterator itCookie = _cookies.find(cookie.c_str());
-			if(itCookie==_cookies.end()) {
-				ERROR("Handshake cookie '%s' unknown",cookie.c_str());
+			if(cookie.size()!=COOKIE_SIZE) {
+				ERROR("Handshake cookie of %u bytes invalid",(UInt32)cookie.size());
+				return 0;
+			}
+
+			// the url of a stateless cookie will be given by the connection message
+			string queryUrl;
+			bool consumed;
+			if(_statelessCookies) {
+				if(!checkCookie((const UInt8*)cookie.c_str())) {
+					ERROR("Handshake cookie invalid or expired");
+					return 0;
+				}
+				consumed = _consumedCookies.find((const UInt8*)cookie.c_str()+32);
+			} else {
+				const Cookie* pCookie = _cookies.find((const UInt8*)cookie.c_str());
+				if(!pCookie) {
+					ERROR("Handshake cookie unknown");
+					return 0;
+				}
+				queryUrl = pCookie->queryUrl;
+				consumed = pCookie->consumed;
+			}
+
+			// Retransmission of a request already answered, from the same address
+			UInt8 idResponse = cachedResponse(_sessionResponses,cookie,peer().address,response);
+			if(idResponse>0) {
+				DEBUG("Handshake 0x38 repeated, cached response");
+				return idResponse;
+			}
+			if(consumed) {
+				ERROR("Handshake cookie already consumed");
+				return 0;
+			}
+
+			if(_keyExchanges.find(cookie)!=_keyExchanges.end()) {
+				DEBUG("Handshake 0x38 repeated, its key exchange is in progress");
 				return 0;
 			}
 
+			KeyExchange* pKeyExchange = new KeyExchange(_gateway,_pDHPool,cookie,_farId,peer().address);
+
 			request.read8(); // why 0x81?
 
 			// signature
-			string farSignature;
-			request.readString8(farSignature); // 81 02 1D 02 stable
+			request.readString8(pKeyExchange->farSignature); // 81 02 1D 02 stable
 
 			// farPubKeyPart
-			UInt8 farPubKeyPart[128];
-			request.readRaw((char*)farPubKeyPart,sizeof(farPubKeyPart));
+			request.readRaw((char*)pKeyExchange->farPubKey,sizeof(pKeyExchange->farPubKey));
 
-			string farCertificat;
-			request.readString8(farCertificat);
-			
-			// peerId = SHA256(farSignature+farPubKey)
-			string temp(farSignature);
-			temp.append((char*)farPubKeyPart,sizeof(farPubKeyPart));
-			EVP_Digest(temp.c_str(),temp.size(),(UInt8*)peer().id,NULL,EVP_sha256(),NULL);
-			
-			// Compute Diffie-Hellman secret
-			UInt8 pubKey[128];
-			UInt8 sharedSecret[128];
-			RTMFP::EndDiffieHellman(RTMFP::BeginDiffieHellman(pubKey),farPubKeyPart,sharedSecret);
-
-			// Compute Keys
-			UInt8 requestKey[AES_KEY_SIZE];
-			UInt8 responseKey[AES_KEY_SIZE];
-			RTMFP::ComputeAsymetricKeys(sharedSecret,pubKey,_signature,farCertificat,requestKey,responseKey);
-
-			// RESPONSE
-			Util::UnpackUrl(itCookie->second->queryUrl,(string&)peer().path,(map<string,string>&)peer().parameters);
-			response << _gateway.createSession(_farId,peer(),requestKey,responseKey);
-			response.write8(0x81);
-			response.writeString8(_signature);
-			response.writeRaw((char*)pubKey,sizeof(pubKey));
-			response.write8(0x58);
-
-			// remove cookie
-			_cookies.erase(itCookie);
-
-			return 0x78;
+			request.readString8(pKeyExchange->farCertificat);
+
+			if(_pCryptoPool) {
+				// the loop thread will create the session and respond when the crypto pool will have finished
+				pKeyExchange->signature = _signature;
+				_keyExchanges[cookie] = pKeyExchange;
+				_pCryptoPool->push(pKeyExchange);
+				return 0;
+			}
+
+			pKeyExchange->compute(_signature);
+			idResponse = keyExchangeHandler(*pKeyExchange,queryUrl,response);
+			delete pKeyExchange;
+			return idResponse;
 		}
 		default:
 			ERROR("Unkown handshake packet id '%02x'",id);
@@ -190,6 +325,91 @@ UInt8 Handshake::handshakeHandler(UInt8 id,PacketReader& request,PacketWriter& r
 	return 0;
 }
 
+UInt8 Handshake::keyExchangeHandler(const KeyExchange& keyExchange,const string& queryUrl,PacketWriter& response) {
+	if(!keyExchange.exchanged)
+		return 0;
+	int start = response.position();
+	memcpy((UInt8*)peer().id,keyExchange.peerId,sizeof(keyExchange.peerId));
+
+	// RESPONSE
+	((map<string,string>&)peer().parameters).clear();
+	Util::UnpackUrl(queryUrl,(string&)peer().path,(map<string,string>&)peer().parameters);
+	UInt32 idSession = _gateway.createSession(_farId,peer(),keyExchange.requestKey,keyExchange.responseKey);
+	if(idSession==0)
+		return 0;
+	response << idSession;
+	response.write8(0x81);
+	response.writeString8(_signature);
+	response.writeRaw((char*)keyExchange.pubKey,sizeof(keyExchange.pubKey));
+	response.write8(0x58);
+	cacheResponse(_sessionResponses,keyExchange.cookie,keyExchange.address,0x78,response,start);
+	const UInt8* cookie = (const UInt8*)keyExchange.cookie.c_str();
+	if(_statelessCookies)
+		_consumedCookies.add(cookie+32,CookieExpiration(cookie));
+	else {
+		Cookie* pCookie = _cookies.find(cookie);
+		if(pCookie)
+			pCookie->consumed = true;
+	}
+	return 0x78;
+}
+
+void Handshake::keyExchanged(KeyExchange* pKeyExchange) {
+	_keyExchanges.erase(pKeyExchange->cookie);
+	Cookie* pCookie = NULL;
+	if(!_statelessCookies) {
+		pCookie = _cookies.find((const UInt8*)pKeyExchange->cookie.c_str());
+		if(!pCookie) {
+			// cookie expired or handshake cleared during the key exchange
+			delete pKeyExchange;
+			return;
+		}
+	}
+
+	// the handshake session takes the context of the request
+	setAddress(pKeyExchange->address);
+	_farId = pKeyExchange->farId;
+
+	PacketWriter& packetOut(writer());
+	UInt8 idResponse=0;
+	{
+		PacketWriter response(packetOut,3);
+		idResponse = keyExchangeHandler(*pKeyExchange,pCookie ? pCookie->queryUrl : string(),response);
+	}
+	delete pKeyExchange;
+	if(idResponse==0) {
+		_farId=0;
+		return;
+	}
+
+	send(idResponse);
+}
+
+void Handshake::p2pHandshaked(const string& tag,const SocketAddress& address,const Peer& peerWanted) {
+	// the handshake session takes the context of the request
+	setAddress(address);
+	_farId = 0;
+
+	PacketWriter& packetOut(writer());
+	{
+		PacketWriter response(packetOut,3);
+		response.writeString8(tag);
+		WriteAddresses(response,peerWanted,address);
+	}
+	send(0x71);
+}
+
+void Handshake::WriteAddresses(PacketWriter& response,const Peer& peerWanted,const SocketAddress& address) {
+	response.writeAddress(peerWanted.address,true);
+	vector<Address>::const_iterator it;
+	for(it=peerWanted.privateAddress.begin();it!=peerWanted.privateAddress.end();++it) {
+		const Address& addr = *it;
+		if(addr == address)
+			continue;
+		response.writeAddress(addr,false);
+	}
+}
+
 
 
 
@@ -0,0 +1,212 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "IOUring.h"
+
+#if defined(CUMULUS_URING)
+
+#include "string.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+IOUring::IOUring() : _fd(-1),_pSQRing(MAP_FAILED),_sqRingSize(0),_pCQRing(MAP_FAILED),_cqRingSize(0),_pSQEs((io_uring_sqe*)MAP_FAILED),_sqesSize(0),
+	_pSQHead(NULL),_pSQTail(NULL),_sqMask(0),_sqEntries(0),_pSQArray(NULL),_sqTail(0),_toSubmit(0),
+	_pCQHead(NULL),_pCQTail(NULL),_cqMask(0),_pCQEs(NULL),
+	_pBufRing(NULL),_bufRingSize(0),_bufGroup(0),_bufMask(0),_bufTail(0),_buffers(NULL),_bufSize(0) {
+}
+
+IOUring::~IOUring() {
+	close();
+}
+
+int IOUring::open(UInt32 entries,UInt32 cqEntries) {
+	close();
+	struct io_uring_params params;
+	memset(&params,0,sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = cqEntries;
+	_fd = syscall(__NR_io_uring_setup,entries,&params);
+	if(_fd<0) {
+		int error = errno;
+		_fd = -1;
+		return -error;
+	}
+
+	_sqRingSize = params.sq_off.array + params.sq_entries*sizeof(UInt32);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(_cqRingSize>_sqRingSize)
+			_sqRingSize = _cqRingSize;
+		_cqRingSize = 0;
+	}
+	_pSQRing = mmap(NULL,_sqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_SQ_RING);
+	if(_pSQRing==MAP_FAILED) {
+		int error = errno;
+		close();
+		return -error;
+	}
+	if(_cqRingSize>0) {
+		_pCQRing = mmap(NULL,_cqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_CQ_RING);
+		if(_pCQRing==MAP_FAILED) {
+			int error = errno;
+			close();
+			return -error;
+		}
+	}
+	_sqesSize = params.sq_entries*sizeof(io_uring_sqe);
+	_pSQEs = (io_uring_sqe*)mmap(NULL,_sqesSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,_fd,IORING_OFF_SQES);
+	if(_pSQEs==MAP_FAILED) {
+		int error = errno;
+		close();
+		return -error;
+	}
+
+	UInt8* pSQ = (UInt8*)_pSQRing;
+	_pSQHead = (UInt32*)(pSQ+params.sq_off.head);
+	_pSQTail = (UInt32*)(pSQ+params.sq_off.tail);
+	_sqMask = *(UInt32*)(pSQ+params.sq_off.ring_mask);
+	_sqEntries = params.sq_entries;
+	_pSQArray = (UInt32*)(pSQ+params.sq_off.array);
+	_sqTail = *_pSQTail;
+
+	UInt8* pCQ = (UInt8*)(_pCQRing==MAP_FAILED ? _pSQRing : _pCQRing);
+	_pCQHead = (UInt32*)(pCQ+params.cq_off.head);
+	_pCQTail = (UInt32*)(pCQ+params.cq_off.tail);
+	_cqMask = *(UInt32*)(pCQ+params.cq_off.ring_mask);
+	_pCQEs = (io_uring_cqe*)(pCQ+params.cq_off.cqes);
+	return 0;
+}
+
+void IOUring::close() {
+	if(_pBufRing) {
+		struct io_uring_buf_reg reg;
+		memset(&reg,0,sizeof(reg));
+		reg.bgid = _bufGroup;
+		syscall(__NR_io_uring_register,_fd,IORING_UNREGISTER_PBUF_RING,&reg,1);
+		munmap(_pBufRing,_bufRingSize);
+		_pBufRing = NULL;
+	}
+	if(_pSQEs!=MAP_FAILED)
+		munmap(_pSQEs,_sqesSize);
+	if(_pCQRing!=MAP_FAILED)
+		munmap(_pCQRing,_cqRingSize);
+	if(_pSQRing!=MAP_FAILED)
+		munmap(_pSQRing,_sqRingSize);
+	_pSQEs = (io_uring_sqe*)MAP_FAILED;
+	_pCQRing = _pSQRing = MAP_FAILED;
+	if(_fd>=0)
+		::close(_fd);
+	_fd = -1;
+	_toSubmit = 0;
+}
+
+io_uring_sqe* IOUring::sqe() {
+	UInt32 head = __atomic_load_n(_pSQHead,__ATOMIC_ACQUIRE);
+	if(_sqTail-head>=_sqEntries)
+		return NULL;
+	UInt32 index = _sqTail&_sqMask;
+	io_uring_sqe* pSQE = &_pSQEs[index];
+	memset(pSQE,0,sizeof(io_uring_sqe));
+	_pSQArray[index] = index;
+	++_sqTail;
+	++_toSubmit;
+	return pSQE;
+}
+
+int IOUring::submit(UInt32 wait) {
+	__atomic_store_n(_pSQTail,_sqTail,__ATOMIC_RELEASE);
+	int result;
+	do {
+		result = syscall(__NR_io_uring_enter,_fd,_toSubmit,wait,wait>0 ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+	} while(result<0 && errno==EINTR);
+	if(result<0)
+		return -errno;
+	_toSubmit -= result;
+	return result;
+}
+
+void IOUring::discard() {
+	_sqTail -= _toSubmit;
+	_toSubmit = 0;
+	__atomic_store_n(_pSQTail,_sqTail,__ATOMIC_RELEASE);
+}
+
+io_uring_cqe* IOUring::cqe() {
+	UInt32 head = *_pCQHead;
+	if(head==__atomic_load_n(_pCQTail,__ATOMIC_ACQUIRE))
+		return NULL;
+	return &_pCQEs[head&_cqMask];
+}
+
+void IOUring::seen() {
+	__atomic_store_n(_pCQHead,*_pCQHead+1,__ATOMIC_RELEASE);
+}
+
+int IOUring::registerBuffers(UInt16 group,UInt8* buffers,UInt32 size,UInt16 count) {
+	_bufRingSize = count*sizeof(io_uring_buf);
+	void* pRing = mmap(NULL,_bufRingSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(pRing==MAP_FAILED)
+		return -errno;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (UInt64)(uintptr_t)pRing;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if(syscall(__NR_io_uring_register,_fd,IORING_REGISTER_PBUF_RING,&reg,1)<0) {
+		int error = errno;
+		munmap(pRing,_bufRingSize);
+		return -error;
+	}
+	_pBufRing = (io_uring_buf_ring*)pRing;
+	_bufGroup = group;
+	_bufMask = count-1;
+	_bufTail = 0;
+	_buffers = buffers;
+	_bufSize = size;
+	for(UInt16 i=0;i<count;++i)
+		recycle(i);
+	commitBuffers();
+	return 0;
+}
+
+void IOUring::recycle(UInt16 id) {
+	// not _pBufRing->bufs, in C++ the flexible array of the kernel header is shifted by an empty struct
+	io_uring_buf& buf = ((io_uring_buf*)_pBufRing)[_bufTail&_bufMask];
+	buf.addr = (UInt64)(uintptr_t)buffer(id);
+	buf.len = _bufSize;
+	buf.bid = id;
+	++_bufTail;
+}
+
+void IOUring::commitBuffers() {
+	__atomic_store_n(&_pBufRing->tail,_bufTail,__ATOMIC_RELEASE);
+}
+
+
+} // namespace Cumulus
+
+#endif
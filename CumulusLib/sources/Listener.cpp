@@ -22,7 +22,7 @@ using namespace Poco;
 
 namespace Cumulus {
 
-Listener::Listener() {
+Listener::Listener(UInt8 shard) : shard(shard) {
 	
 }
 
@@ -0,0 +1,73 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "LockFreeQueue.h"
+#if defined(_WIN32)
+	#include <windows.h>
+#endif
+
+namespace Cumulus {
+
+static inline QueueNode* Exchange(QueueNode* volatile* ppTarget,QueueNode* pValue) {
+#if defined(_WIN32)
+	return (QueueNode*)InterlockedExchangePointer((PVOID volatile*)ppTarget,pValue);
+#else
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ppTarget,pValue);
+#endif
+}
+
+LockFreeQueue::LockFreeQueue() : _pHead(&_stub),_pTail(&_stub) {
+}
+
+LockFreeQueue::~LockFreeQueue() {
+}
+
+void LockFreeQueue::push(QueueNode* pNode) {
+	pNode->_pNext = NULL;
+	QueueNode* pPrev = Exchange(&_pHead,pNode);
+	// from here the node is visible for the consumer when the link is written
+	pPrev->_pNext = pNode;
+}
+
+QueueNode* LockFreeQueue::pop() {
+	QueueNode* pTail = _pTail;
+	QueueNode* pNext = pTail->_pNext;
+	if(pTail==&_stub) {
+		if(!pNext)
+			return NULL;
+		_pTail = pNext;
+		pTail = pNext;
+		pNext = pNext->_pNext;
+	}
+	if(pNext) {
+		_pTail = pNext;
+		return pTail;
+	}
+	if(pTail!=_pHead)
+		return NULL; // a push is running
+	push(&_stub);
+	pNext = pTail->_pNext;
+	if(pNext) {
+		_pTail = pNext;
+		return pTail;
+	}
+	return NULL;
+}
+
+
+} // namespace Cumulus
@@ -37,12 +37,13 @@ Middle::Middle(UInt32 id,
 				const Peer& peer,
 				const UInt8* decryptKey,
 				const UInt8* encryptKey,
-				DatagramSocket& socket,
+				DatagramEngine& engine,
 				ServerHandler& serverHandler,
-				Cirrus& cirrus) : Session(id,farId,peer,decryptKey,encryptKey,socket,serverHandler),_middleCertificat("\x02\x1D\x02\x41\x0E",5),_pMiddleAesDecrypt(NULL),_pMiddleAesEncrypt(NULL),
+				Cirrus& cirrus) : Session(id,farId,peer,decryptKey,encryptKey,engine,serverHandler),_middleCertificat("\x02\x1D\x02\x41\x0E",5),_pMiddleAesDecrypt(NULL),_pMiddleAesEncrypt(NULL),
 					_cirrus(cirrus),_middleId(0),_firstResponse(false),_queryUrl("rtmfp://"+cirrus.address().toString()+peer.path),_middlePeer(peer) {
 
 	Util::UnpackUrl(_queryUrl,(string&)_middlePeer.path,(map<string,string>&)_middlePeer.parameters);
+	_cirrus.addMiddle(*this);
 
 	// connection to cirrus
 	_socket.connect(_cirrus.address());
@@ -69,6 +70,9 @@ Middle::Middle(UInt32 id,
 }
 
 Middle::~Middle() {
+	_cirrus.removeMiddle(*this);
+	// closed explicitly, the reactor of the worker can share this socket
+	_socket.close();
 	if(_pMiddleAesDecrypt)
 		delete _pMiddleAesDecrypt;
 	if(_pMiddleAesEncrypt)
@@ -103,7 +107,9 @@ void Middle::cirrusHandshakeHandler(UInt8 type,PacketReader& packet) {
 
 			string temp(middleSignature);
 			temp.append((char*)middlePubKey,sizeof(middlePubKey));
+			_cirrus.removeMiddle(*this);
 			EVP_Digest(temp.c_str(),temp.size(),(UInt8*)_middlePeer.id,NULL,EVP_sha256(),NULL);
+			_cirrus.addMiddle(*this);
 			
 
 			PacketWriter& request = handshaker();
@@ -166,7 +172,11 @@ void Middle::cirrusHandshakeHandler(UInt8 type,PacketReader& packet) {
 			packet.readRaw((char*)cirrusPubKey,sizeof(cirrusPubKey));
 
 			UInt8 sharedSecret[128];
-			RTMFP::EndDiffieHellman(_pMiddleDH,cirrusPubKey,sharedSecret);
+			if(!RTMFP::EndDiffieHellman(_pMiddleDH,cirrusPubKey,sharedSecret)) {
+				Session::fail("Invalid Diffie Hellman public key of the 'man in the middle' server");
+				kill();
+				break;
+			}
 
 			UInt8 requestKey[AES_KEY_SIZE];
 			UInt8 responseKey[AES_KEY_SIZE];
@@ -192,8 +202,7 @@ void Middle::sendHandshakeToCirrus(UInt8 type) {
 
 	Logs::Dump(packet,6,"Middle to Cirrus handshaking:",false);
 
-	RTMFP::Encode(packet);
-	RTMFP::Pack(packet);
+	RTMFP::Finalize(packet);
 	_socket.sendBytes(packet.begin(),packet.length());
 }
 
@@ -301,8 +310,7 @@ void Middle::sendToCirrus() {
 	Logs::Dump(packet,6,"Middle to Cirrus:",false);
 
 	_firstResponse = true;
-	RTMFP::Encode(*_pMiddleAesEncrypt,packet);
-	RTMFP::Pack(packet,_middleId);
+	RTMFP::Finalize(*_pMiddleAesEncrypt,packet,_middleId);
 	_socket.sendBytes(packet.begin(),packet.length());
 }
 
@@ -0,0 +1,124 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "PacketPool.h"
+#include "Logs.h"
+#include "Poco/Bugcheck.h"
+#include <new>
+#include <cstddef>
+#if defined(__linux__)
+	#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE	0x200000
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+PacketBuffer::PacketBuffer(PacketPool& pool) : _pool(pool),_pNext(NULL),_references(0) {
+}
+
+PacketBuffer::~PacketBuffer() {
+}
+
+void PacketBuffer::release() {
+	if(--_references==0)
+		_pool.giveBack(this);
+}
+
+
+PacketPool::PacketPool(UInt32 slabBuffers,bool hugePages) : _slabBuffers(slabBuffers==0 ? 1 : slabBuffers),_hugePages(hugePages),_pFree(NULL),_capacity(0),_used(0),_highWater(0) {
+	// the header of a buffer must stay in its cache line
+	poco_static_assert(sizeof(PacketBuffer)<=CACHE_LINE_SIZE);
+}
+
+PacketPool::~PacketPool() {
+	if(_used>0)
+		WARN("Packet pool deleted with %u buffers in use",_used);
+	vector<Slab>::const_iterator it;
+	for(it=_slabs.begin();it!=_slabs.end();++it) {
+#if defined(__linux__)
+		if(it->mapped) {
+			munmap(it->pMemory,it->size);
+			continue;
+		}
+#endif
+		delete [] it->pMemory;
+	}
+}
+
+void PacketPool::grow() {
+	Slab slab;
+	slab.size = _slabBuffers*PACKET_BUFFER_SLOT;
+	slab.mapped = false;
+	slab.pMemory = NULL;
+	UInt8* pBegin = NULL;
+#if defined(__linux__)
+	if(_hugePages) {
+		UInt32 size = (slab.size+HUGE_PAGE_SIZE-1)&~(HUGE_PAGE_SIZE-1);
+		void* pMemory = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if(pMemory==MAP_FAILED) {
+			WARN("Huge pages unavailable for the packet pool, normal pages used");
+			_hugePages = false;
+		} else {
+			slab.pMemory = pBegin = (UInt8*)pMemory;
+			slab.size = size;
+			slab.mapped = true;
+		}
+	}
+#endif
+	UInt32 count = slab.size/PACKET_BUFFER_SLOT;
+	if(!pBegin) {
+		slab.pMemory = new UInt8[slab.size+CACHE_LINE_SIZE];
+		// size_t has the size of a pointer, unsigned long not on Win64
+		pBegin = (UInt8*)(((size_t)slab.pMemory+CACHE_LINE_SIZE-1)&~(size_t)(CACHE_LINE_SIZE-1));
+	}
+	_slabs.push_back(slab);
+
+	for(UInt32 i=0;i<count;++i) {
+		PacketBuffer* pBuffer = new(pBegin+i*PACKET_BUFFER_SLOT) PacketBuffer(*this);
+		pBuffer->_pNext = _pFree;
+		_pFree = pBuffer;
+	}
+	_capacity += count;
+	DEBUG("Packet pool grows to %u buffers",_capacity);
+}
+
+PacketBuffer* PacketPool::acquire() {
+	ScopedLock<FastMutex> lock(_mutex);
+	if(!_pFree)
+		grow();
+	PacketBuffer* pBuffer = _pFree;
+	_pFree = pBuffer->_pNext;
+	pBuffer->_pNext = NULL;
+	pBuffer->_references = 1;
+	if(++_used>_highWater)
+		_highWater = _used;
+	return pBuffer;
+}
+
+void PacketPool::giveBack(PacketBuffer* pBuffer) {
+	ScopedLock<FastMutex> lock(_mutex);
+	pBuffer->_pNext = _pFree;
+	_pFree = pBuffer;
+	--_used;
+}
+
+
+} // namespace Cumulus
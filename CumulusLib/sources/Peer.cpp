@@ -17,9 +17,11 @@
 
 #include "Peer.h"
 #include "Group.h"
+#include "ServerHandler.h"
 #include "Logs.h"
 #include "Util.h"
 #include "string.h"
+#include <algorithm>
 
 using namespace std;
 using namespace Poco;
@@ -27,7 +29,7 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-Peer::Peer(const Poco::Net::SocketAddress& address):_ping(0),address(address) {
+Peer::Peer(const Poco::Net::SocketAddress& address):address(address),_srtt(0),_rttvar(0),_pingSampled(false),_rankedPing(0) {
 }
 
 Peer::~Peer() {
@@ -35,20 +37,41 @@ Peer::~Peer() {
 }
 
 void Peer::unsubscribeGroups() {
-	list<Group*>::iterator it=_groups.begin();
-	while(it!=_groups.end()) {
-		(*it)->_peers.remove(*this);
-		_groups.erase(it);
-		it = _groups.begin();
-	}
+	if(_groups.empty())
+		return;
+	// removePeer erases the group of _groups (and deletes it if it becomes empty)
+	ScopedLock<FastMutex> lock(_groups.front().pGroup->_handler.groupsMutex());
+	while(!_groups.empty())
+		_groups.back().pGroup->removePeer(*this);
 }
 
 void Peer::setPing(Poco::UInt16 ping) {
-	UInt16 oldPing = _ping;
-	_ping=ping;
-	list<Group*>::const_iterator it;
+	if(!_pingSampled) {
+		_srtt = ping<<3;
+		_rttvar = ping<<1; // ping/2
+		_pingSampled = true;
+	} else {
+		// srtt += (sample-srtt)/8, rttvar += (|sample-srtt|-rttvar)/4
+		Int32 delta = (Int32)ping-(Int32)(_srtt>>3);
+		_srtt += delta;
+		if(delta<0)
+			delta = -delta;
+		_rttvar += delta-(Int32)(_rttvar>>2);
+	}
+	((UInt16&)this->ping) = (UInt16)(_srtt>>3);
+	((UInt16&)pingVariance) = (UInt16)(_rttvar>>2);
+
+	// reindex in the groups only if the smoothed ping leaves the hysteresis band
+	UInt16 band = pingVariance>PING_HYSTERESIS ? pingVariance : PING_HYSTERESIS;
+	if((this->ping>_rankedPing ? this->ping-_rankedPing : _rankedPing-this->ping)<=band)
+		return;
+	_rankedPing = this->ping;
+	if(_groups.empty())
+		return;
+	ScopedLock<FastMutex> lock(_groups.front().pGroup->_handler.groupsMutex());
+	vector<Membership>::const_iterator it;
 	for(it=_groups.begin();it!=_groups.end();++it)
-		(*it)->_peers.update(*this,oldPing);
+		it->pGroup->_peers.update(it->handle,_rankedPing);
 }
 
 void Peer::setPrivateAddress(const list<Address>& address) {
@@ -66,16 +89,7 @@ void Peer::setPrivateAddress(const list<Address>& address) {
 }
 
 bool Peer::isIn(Group& group) const {
-	list<Group*>::iterator it;
-	return ((Peer&)*this).isIn(group,it);
-}
-
-bool Peer::isIn(Group& group,list<Group*>::iterator& it) {
-	for(it=_groups.begin();it!=_groups.end();++it) {
-		if(group == **it)
-			return true;
-	}
-	return false;
+	return binary_search(_groups.begin(),_groups.end(),Membership(&group));
 }
 
 
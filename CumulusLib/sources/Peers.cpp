@@ -17,115 +17,242 @@
 
 #include "Peers.h"
 #include "Logs.h"
-
-#define		MAX_BEST_PEERS	6
+#include <algorithm>
+#include <cstring>
 
 using namespace std;
 using namespace Poco;
+using namespace Poco::Net;
 
 namespace Cumulus {
 
-Peers::Peers() {
-	
+IntroductionStats::IntroductionStats() : members(0),introductions(0),max(0) {
+	memset(histogram,0,sizeof(histogram));
+}
+
+
+Peers::Peers(bool proximity) : _free(PEERS_NONE),_filled(0),_count(0),_proximity(proximity) {
+	for(UInt8 i=0;i<PEERS_BUCKETS;++i)
+		_heads[i] = PEERS_NONE;
+	_random.seed((UInt32)Timestamp().epochMicroseconds());
 }
 
 Peers::~Peers() {
-	// delete list
-	map<UInt16,list<const Peer*>*>::const_iterator it;
-	for(it=_peers.begin();it!=_peers.end();++it)
-		delete it->second;
-	_peers.clear();
 }
 
-void Peers::add(const Peer& peer) {
-	list<const Peer*>::const_iterator it;
+UInt32 Peers::add(const Peer& peer,UInt16 ping) {
+	UInt32 handle = _free;
+	if(handle==PEERS_NONE) {
+		handle = _nodes.size();
+		_nodes.push_back(Node());
+	} else
+		_free = _nodes[handle].next;
+	_nodes[handle].pPeer = &peer;
+	_nodes[handle].introductions = 0;
+	_nodes[handle].introductionTime = 0;
+	if(_proximity) {
+		ProximityKey(peer,handle,_nodes[handle].proximityKey);
+		_proximityIndex.insert(_nodes[handle].proximityKey);
+	}
+	link(handle,peer.address.host().isLoopback() ? (PEERS_BUCKETS-1) : Bucket(ping));
+	++_count;
+	return handle;
+}
 
-	if(peer.address.host().isLoopback()) {
-		for(it=_localPeers.begin();it!=_localPeers.end();++it) {
-			if(*it==&peer)
-				return; // already included
-		}
-		_localPeers.push_front(&peer);
-	} else {
-		list<const Peer*>& peers(*_peers.insert(pair<UInt16,list<const Peer*>*>(peer.getPing(),new std::list<const Peer*>())).first->second);
-		for(it=peers.begin();it!=peers.end();++it) {
-			if(*it==&peer)
-				return; // already included
-		}
-		peers.push_back(&peer);
+void Peers::remove(UInt32 handle) {
+	if(handle>=_nodes.size() || !_nodes[handle].pPeer) {
+		ERROR("Peer remove impossible because the peer is not in the group");
+		return;
 	}
+	unlink(handle);
+	Node& node = _nodes[handle];
+	if(_proximity) {
+		_proximityIndex.erase(node.proximityKey);
+		node.proximityKey.clear();
+	}
+	node.pPeer = NULL;
+	node.next = _free;
+	_free = handle;
+	--_count;
 }
 
-void Peers::remove(const Peer& peer) {
-	
-	if(peer.address.host().isLoopback()) {
-		list<const Peer*>::iterator it;
-		for(it=_localPeers.begin();it!=_localPeers.end();++it) {
-			if(*it==&peer) {
-				_localPeers.erase(it);
-				break;
-			}
-		}
-	} else {
-		map<UInt16,list<const Peer*>*>::const_iterator it = _peers.find(peer.getPing());
-		if(it == _peers.end())
-			return;
-		list<const Peer*>& peers(*it->second);
-		list<const Peer*>::iterator itP;
-		for(itP=peers.begin();itP!=peers.end();++itP) {
-			if(*itP==&peer) {
-				peers.erase(itP);
-				break;
+void Peers::update(UInt32 handle,UInt16 ping) {
+	if(handle>=_nodes.size() || !_nodes[handle].pPeer) {
+		ERROR("Peer update impossible because the peer is not in the group");
+		return;
+	}
+	Node& node = _nodes[handle];
+	UInt8 bucket = Bucket(ping);
+	if(node.bucket==(PEERS_BUCKETS-1) || node.bucket==bucket)
+		return;
+	unlink(handle);
+	link(handle,bucket);
+}
+
+void Peers::link(UInt32 handle,UInt8 bucket) {
+	Node& node = _nodes[handle];
+	node.bucket = bucket;
+	node.prev = PEERS_NONE;
+	node.next = _heads[bucket];
+	if(node.next!=PEERS_NONE)
+		_nodes[node.next].prev = handle;
+	_heads[bucket] = handle;
+	_filled |= (1U<<bucket);
+}
+
+void Peers::unlink(UInt32 handle) {
+	Node& node = _nodes[handle];
+	if(node.prev==PEERS_NONE)
+		_heads[node.bucket] = node.next;
+	else
+		_nodes[node.prev].next = node.next;
+	if(node.next!=PEERS_NONE)
+		_nodes[node.next].prev = node.prev;
+	if(_heads[node.bucket]==PEERS_NONE)
+		_filled &= ~(1U<<node.bucket);
+}
+
+void Peers::best(list<const Peer*>& peers,const Peer& askerPeer) {
+	UInt32 now = (UInt32)(Timestamp().epochMicroseconds()/1000000);
+	UInt32 handles[MAX_BEST_PEERS];
+	UInt8 count = _proximity ? nearest(askerPeer,handles) : 0;
+	UInt8 nearestCount = count;
+
+	// candidates of lowest ping, scored by their ping bucket, their recent introductions and a random tie-break
+	UInt64 candidates[PEERS_CANDIDATES];
+	UInt8 candidatesCount=0;
+	for(UInt8 bucket=0;bucket<PEERS_BUCKETS && candidatesCount<PEERS_CANDIDATES;++bucket) {
+		if(!(_filled&(1U<<bucket)))
+			continue;
+		UInt32 handle = _heads[bucket];
+		while(handle!=PEERS_NONE && candidatesCount<PEERS_CANDIDATES) {
+			const Node& node = _nodes[handle];
+			if(node.pPeer!=&askerPeer && find(handles,handles+nearestCount,handle)==handles+nearestCount) {
+				UInt32 score = bucket+INTRODUCTION_PENALTY*introductions(node,now);
+				candidates[candidatesCount++] = ((UInt64)score<<48) | ((UInt64)(_random.next()&0xFFFF)<<32) | handle;
 			}
+			handle = node.next;
 		}
 	}
+	sort(candidates,candidates+candidatesCount);
+	for(UInt8 i=0;i<candidatesCount && count<MAX_BEST_PEERS;++i)
+		handles[count++] = (UInt32)candidates[i];
+
+	for(UInt8 i=0;i<count;++i) {
+		peers.push_back(_nodes[handles[i]].pPeer);
+		introduce(handles[i],now);
+	}
 }
 
-void Peers::update(const Peer& peer,UInt16 oldPing) {
-	if(peer.address.host().isLoopback())
-		return;
-	
-	map<UInt16,list<const Peer*>*>::const_iterator it = _peers.find(oldPing);
-	if(it == _peers.end()) {
-		ERROR("Peer update impossible because the peer is not in the group");
-		return;
+UInt8 Peers::nearest(const Peer& askerPeer,UInt32* handles) const {
+	string key;
+	ProximityKey(askerPeer,0,key);
+	key.resize(32);
+
+	UInt16 minPrefix = askerPeer.address.host().family()==IPAddress::IPv6 ? PROXIMITY_PREFIX_IPV6 : (96+PROXIMITY_PREFIX_IPV4);
+
+	// The common prefix decreases from the position of the asker in the two directions,
+	// so merge the two directions by the longest common prefix
+	set<string>::const_iterator itNext = _proximityIndex.lower_bound(key);
+	set<string>::const_iterator itPrev = itNext;
+	UInt16 nextPrefix = itNext==_proximityIndex.end() ? 0 : CommonPrefix(key,*itNext);
+	UInt16 prevPrefix = itPrev==_proximityIndex.begin() ? 0 : CommonPrefix(key,*--itPrev);
+	UInt8 count=0;
+	while(count<MAX_BEST_PEERS) {
+		set<string>::const_iterator it;
+		if(nextPrefix>=prevPrefix && nextPrefix>=minPrefix) {
+			it = itNext++;
+			nextPrefix = itNext==_proximityIndex.end() ? 0 : CommonPrefix(key,*itNext);
+		} else if(prevPrefix>=minPrefix) {
+			it = itPrev;
+			prevPrefix = itPrev==_proximityIndex.begin() ? 0 : CommonPrefix(key,*--itPrev);
+		} else
+			break;
+		const UInt8* bytes = (const UInt8*)it->data()+32;
+		UInt32 handle = (bytes[0]<<24) | (bytes[1]<<16) | (bytes[2]<<8) | bytes[3];
+		if(_nodes[handle].pPeer==&askerPeer)
+			continue;
+		handles[count++] = handle;
 	}
+	return count;
+}
+
+UInt16 Peers::introductions(const Node& node,UInt32 now) const {
+	UInt32 halvings = (now-node.introductionTime)/INTRODUCTION_HALF_LIFE;
+	return halvings>=16 ? 0 : (node.introductions>>halvings);
+}
+
+void Peers::introduce(UInt32 handle,UInt32 now) {
+	Node& node = _nodes[handle];
+	UInt32 elapsed = now-node.introductionTime;
+	node.introductions = introductions(node,now);
+	// keeps the rest of the current half-life period
+	node.introductionTime = now-(elapsed%INTRODUCTION_HALF_LIFE);
+	if(node.introductions<0xFFFF)
+		++node.introductions;
+}
 
-	list<const Peer*>& peers(*it->second);
-	list<const Peer*>::iterator itP;
-	for(itP=peers.begin();itP!=peers.end();++itP) {
-		if(*itP==&peer) {
-			peers.erase(itP);
-			_peers.insert(pair<UInt16,list<const Peer*>*>(peer.getPing(),new std::list<const Peer*>())).first->second->push_back(&peer);
-			return;
+void Peers::introductions(IntroductionStats& stats) const {
+	UInt32 now = (UInt32)(Timestamp().epochMicroseconds()/1000000);
+	vector<Node>::const_iterator it;
+	for(it=_nodes.begin();it!=_nodes.end();++it) {
+		if(!it->pPeer)
+			continue;
+		UInt16 value = introductions(*it,now);
+		++stats.members;
+		stats.introductions += value;
+		if(value>stats.max)
+			stats.max = value;
+		UInt8 bin=0;
+		while(value>0 && bin<(INTRODUCTION_BINS-1)) {
+			value >>= 1;
+			++bin;
 		}
+		++stats.histogram[bin];
 	}
 }
 
-void Peers::best(list<const Peer*>& peers,const Peer& askerPeer) const {
-	list<const Peer*>::const_iterator itP;
-	map<UInt16,list<const Peer*>*>::const_iterator it;
-	for(it=_peers.begin();it!=_peers.end();++it) {
-		const list<const Peer*>& curPeers(*it->second);
-		for(itP=curPeers.begin();itP!=curPeers.end();++itP) {
-			if(*itP==&askerPeer)
-				continue;
-			peers.push_back(*itP);
-			if(peers.size()==MAX_BEST_PEERS)
-				break;
+void Peers::ProximityKey(const Peer& peer,UInt32 handle,string& key) {
+	key.assign(36,0);
+	// public host
+	IPAddress host = peer.address.host();
+	if(host.family()==IPAddress::IPv6)
+		memcpy(&key[0],host.addr(),16);
+	else {
+		key[10] = key[11] = (char)0xFF;
+		memcpy(&key[12],host.addr(),4);
+	}
+	// private host (peers behind the same NAT)
+	if(!peer.privateAddress.empty()) {
+		const vector<UInt8>& privateHost = peer.privateAddress[0].host;
+		if(privateHost.size()==16)
+			memcpy(&key[16],&privateHost[0],16);
+		else if(privateHost.size()==4) {
+			key[26] = key[27] = (char)0xFF;
+			memcpy(&key[28],&privateHost[0],4);
 		}
-		if(peers.size()==MAX_BEST_PEERS)
-			break;
 	}
-	if(peers.size()<MAX_BEST_PEERS) {
-		for(itP=_localPeers.begin();itP!=_localPeers.end();++itP) {
-			if(*itP==&askerPeer)
-				continue;
-			peers.push_back(*itP);
-			if(peers.size()==MAX_BEST_PEERS)
-				break;
+	key[32] = (char)(handle>>24);
+	key[33] = (char)(handle>>16);
+	key[34] = (char)(handle>>8);
+	key[35] = (char)handle;
+}
+
+UInt16 Peers::CommonPrefix(const string& key1,const string& key2) {
+	UInt16 bits=0;
+	for(UInt8 i=0;i<32;++i) {
+		UInt8 diff = (UInt8)key1[i]^(UInt8)key2[i];
+		if(diff==0) {
+			bits += 8;
+			continue;
+		}
+		while(!(diff&0x80)) {
+			diff <<= 1;
+			++bits;
 		}
+		break;
 	}
+	return bits;
 }
 
 
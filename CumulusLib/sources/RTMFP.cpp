@@ -25,6 +25,13 @@
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+	#define RTMFP_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#endif
 
 #define TIMESTAMP_SCALE 4
 
@@ -33,28 +40,10 @@ using namespace Poco;
 
 namespace Cumulus {
 
-AESEngine RTMFP::s_aesDecrypt(RTMFP_SYMETRIC_KEY,AESEngine::DECRYPT);
-AESEngine RTMFP::s_aesEncrypt(RTMFP_SYMETRIC_KEY,AESEngine::ENCRYPT);
-
-
-UInt8 g_dh1024p[] = {
-	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-	0xC9, 0x0F, 0xDA, 0xA2, 0x21, 0x68, 0xC2, 0x34,
-	0xC4, 0xC6, 0x62, 0x8B, 0x80, 0xDC, 0x1C, 0xD1,
-	0x29, 0x02, 0x4E, 0x08, 0x8A, 0x67, 0xCC, 0x74,
-	0x02, 0x0B, 0xBE, 0xA6, 0x3B, 0x13, 0x9B, 0x22,
-	0x51, 0x4A, 0x08, 0x79, 0x8E, 0x34, 0x04, 0xDD,
-	0xEF, 0x95, 0x19, 0xB3, 0xCD, 0x3A, 0x43, 0x1B,
-	0x30, 0x2B, 0x0A, 0x6D, 0xF2, 0x5F, 0x14, 0x37,
-	0x4F, 0xE1, 0x35, 0x6D, 0x6D, 0x51, 0xC2, 0x45,
-	0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6,
-	0xF4, 0x4C, 0x42, 0xE9, 0xA6, 0x37, 0xED, 0x6B,
-	0x0B, 0xFF, 0x5C, 0xB6, 0xF4, 0x06, 0xB7, 0xED,
-	0xEE, 0x38, 0x6B, 0xFB, 0x5A, 0x89, 0x9F, 0xA5,
-	0xAE, 0x9F, 0x24, 0x11, 0x7C, 0x4B, 0x1F, 0xE6,
-	0x49, 0x28, 0x66, 0x51, 0xEC, 0xE6, 0x53, 0x81,
-	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
-};
+// shared by all the threads, so LEGACY engines
+AESEngine RTMFP::s_aesDecrypt(RTMFP_SYMETRIC_KEY,AESEngine::DECRYPT,AESEngine::LEGACY);
+AESEngine RTMFP::s_aesEncrypt(RTMFP_SYMETRIC_KEY,AESEngine::ENCRYPT,AESEngine::LEGACY);
+
 
 RTMFP::RTMFP() {
 
@@ -65,13 +54,62 @@ RTMFP::~RTMFP() {
 
 
 UInt16 RTMFP::CheckSum(PacketReader& packet) {
+	return CheckSum(packet.current(),packet.available());
+}
 
-	int sum = 0;
-	int pos = packet.position();
-	while(packet.available()>0)
-		sum += packet.available()==1 ? packet.read8() : packet.read16();
-	packet.reset(pos);
+UInt16 RTMFP::CheckSum(const UInt8* data,int size) {
+	return Fold(Sum(data,size));
+}
 
+UInt32 RTMFP::Sum(const UInt8* data,int size) {
+	UInt32 sum = 0;
+	int i=0;
+	// The sum of the words is 256*(sum of the even bytes)+(sum of the odd bytes),
+	// so the bytes are summed by SAD in 64 bits lanes, exactly and without byte swapping
+#if defined(__AVX2__)
+	if(size>=32) {
+		const __m256i mask = _mm256_set1_epi16(0x00FF);
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i highs = zero;
+		__m256i lows = zero;
+		for(;i+32<=size;i+=32) {
+			__m256i words = _mm256_loadu_si256((const __m256i*)(data+i));
+			highs = _mm256_add_epi64(highs,_mm256_sad_epu8(_mm256_and_si256(words,mask),zero));
+			lows = _mm256_add_epi64(lows,_mm256_sad_epu8(_mm256_srli_epi16(words,8),zero));
+		}
+		__m128i high = _mm_add_epi64(_mm256_castsi256_si128(highs),_mm256_extracti128_si256(highs,1));
+		__m128i low = _mm_add_epi64(_mm256_castsi256_si128(lows),_mm256_extracti128_si256(lows,1));
+		high = _mm_add_epi64(high,_mm_srli_si128(high,8));
+		low = _mm_add_epi64(low,_mm_srli_si128(low,8));
+		sum += ((UInt32)_mm_cvtsi128_si32(high)<<8) + (UInt32)_mm_cvtsi128_si32(low);
+	}
+#endif
+#if defined(RTMFP_SSE2)
+	if(size-i>=16) {
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i high = zero;
+		__m128i low = zero;
+		for(;i+16<=size;i+=16) {
+			__m128i words = _mm_loadu_si128((const __m128i*)(data+i));
+			high = _mm_add_epi64(high,_mm_sad_epu8(_mm_and_si128(words,mask),zero));
+			low = _mm_add_epi64(low,_mm_sad_epu8(_mm_srli_epi16(words,8),zero));
+		}
+		high = _mm_add_epi64(high,_mm_srli_si128(high,8));
+		low = _mm_add_epi64(low,_mm_srli_si128(low,8));
+		sum += ((UInt32)_mm_cvtsi128_si32(high)<<8) + (UInt32)_mm_cvtsi128_si32(low);
+	}
+#endif
+	for(;i<size-1;i+=2)
+		sum += (data[i]<<8) | data[i+1];
+	// last odd byte
+	if(i<size)
+		sum += data[i];
+	return sum;
+}
+
+UInt16 RTMFP::Fold(UInt32 value) {
+  int sum = (int)value;
   /* add back carry outs from top 16 bits to low 16 bits */
   sum = (sum >> 16) + (sum & 0xffff);     /* add hi 16 to low 16 */
   sum += (sum >> 16);                     /* add carry */
@@ -80,32 +118,53 @@ UInt16 RTMFP::CheckSum(PacketReader& packet) {
 
 
 bool RTMFP::Decode(AESEngine& aesDecrypt,PacketReader& packet) {
-	// Decrypt
-	aesDecrypt.process(packet.current(),packet.current(),packet.available());
+	bool result = Decode(aesDecrypt,packet.current(),packet.available());
+	// after the 2 CRC bytes
+	packet.reset(6);
+	return result;
+}
 
-	// Check the first 2 CRC bytes 
-	packet.reset(4);
-	UInt16 sum = packet.read16();
-	return (sum == CheckSum(packet));
+bool RTMFP::Decode(AESEngine& aesDecrypt,UInt8* data,int size) {
+	// Each part is summed just after its decryption, so the packet is read once.
+	// The first 2 bytes are the CRC, and the parts are even so the words stay aligned.
+	UInt8 iv[AES_BLOCK_SIZE];
+	memset(iv,0,sizeof(iv));
+	UInt32 sum = 0;
+	for(int i=0;i<size;i+=RTMFP_DECODE_CHUNK) {
+		int length = size-i<RTMFP_DECODE_CHUNK ? size-i : RTMFP_DECODE_CHUNK;
+		aesDecrypt.process(data+i,data+i,length,iv);
+		sum += i==0 ? Sum(data+2,length-2) : Sum(data+i,length);
+	}
+	return ((data[0]<<8) | data[1]) == Fold(sum);
 }
 
 
 void RTMFP::Encode(AESEngine& aesEncrypt,PacketWriter& packet) {
+	packet.clear(4+Encode(aesEncrypt,packet.begin()+4,packet.length()-4));
+}
+
+void RTMFP::Finalize(AESEngine& aesEncrypt,PacketWriter& packet,UInt32 farId) {
+	UInt8* data = packet.begin();
+	packet.clear(4+Encode(aesEncrypt,data+4,packet.length()-4));
+	// the first encrypted block is still in the L1 cache
+	Pack(data,farId);
+}
+
+int RTMFP::Encode(AESEngine& aesEncrypt,UInt8* data,int size) {
 	// paddingBytesLength=(0xffffffff-plainRequestLength+5)&0x0F
-	int paddingBytesLength = (0xFFFFFFFF-packet.length()+5)&0x0F;
+	int paddingBytesLength = (0xFFFFFFFF-(size+4)+5)&0x0F;
 	// Padd the plain request with paddingBytesLength of value 0xff at the end
-	packet.reset(packet.length());
-	string end(paddingBytesLength,(UInt8)0xFF);
-	packet.writeRaw(end);
-	// Compute the CRC and add it at the beginning of the request
-	PacketReader reader(packet.begin(),packet.length());
-	reader.next(6);
-	UInt16 sum = CheckSum(reader);
-	packet.reset(4);packet << sum;
+	memset(data+size,0xFF,paddingBytesLength);
+	size += paddingBytesLength;
+	// Compute the CRC and add it at the beginning of the request.
+	// It's in the first block of the CBC chain, so it can't be computed during the encryption
+	UInt16 sum = CheckSum(data+2,size-2);
+	data[0] = sum>>8;
+	data[1] = sum&0xFF;
 	
 	// Encrypt the resulted request
-	reader.reset(4);
-	aesEncrypt.process(reader.current(),reader.current(),reader.available());
+	aesEncrypt.process(data,data,size);
+	return size;
 }
 
 UInt32 RTMFP::Unpack(PacketReader& packet) {
@@ -118,33 +177,32 @@ UInt32 RTMFP::Unpack(PacketReader& packet) {
 }
 
 void RTMFP::Pack(PacketWriter& packet,UInt32 farId) {
-	PacketReader reader(packet.begin(),packet.length());
-	reader.read32();
-	packet.reset(0);
-	packet.write32(reader.read32()^reader.read32()^farId);
+	Pack(packet.begin(),farId);
 }
 
-DH* RTMFP::BeginDiffieHellman(UInt8* pubKey) {
-	DH*	pDH = DH_new();
-	pDH->p = BN_new();
-	pDH->g = BN_new();
-
-	BN_set_word(pDH->g, 2); //group DH 2
-	BN_bin2bn(g_dh1024p,128,pDH->p); //prime number
-	int ret = DH_generate_key(pDH); // TODO que faire de ret?
+void RTMFP::Pack(UInt8* data,UInt32 farId) {
+	UInt32 id = farId;
+	for(int i=4;i<12;i+=4)
+		id ^= (data[i]<<24) | (data[i+1]<<16) | (data[i+2]<<8) | data[i+3];
+	data[0] = id>>24;
+	data[1] = (id>>16)&0xFF;
+	data[2] = (id>>8)&0xFF;
+	data[3] = id&0xFF;
+}
 
+DHEngine* RTMFP::BeginDiffieHellman(UInt8* pubKey) {
+	DHEngine* pDH = new DHEngine();
 	// It's our key public part
-	BN_bn2bin(pDH->pub_key,pubKey);
+	memcpy(pubKey,pDH->publicKey(),DH_KEY_SIZE);
 	return pDH;
 }
 
-void RTMFP::EndDiffieHellman(DH* pDH,const UInt8* farPubKey,UInt8* sharedSecret) {
-	BIGNUM *bnFarPubKey = BN_bin2bn(farPubKey,0x80,NULL);
-	if(DH_compute_key(sharedSecret, bnFarPubKey,pDH)<=0)
+bool RTMFP::EndDiffieHellman(DHEngine* pDH,const UInt8* farPubKey,UInt8* sharedSecret) {
+	bool result = pDH->computeSecret(farPubKey,sharedSecret);
+	if(!result)
 		ERROR("Diffie Hellman exchange failed : dh compute key error");
-	BN_free(bnFarPubKey);
-
-	DH_free(pDH);
+	delete pDH;
+	return result;
 }
 
 void RTMFP::ComputeAsymetricKeys(const UInt8* sharedSecret,const UInt8* serverPubKey,const string& serverSignature,const string& clientCertificat,UInt8* requestKey,UInt8* responseKey) {
@@ -16,13 +16,19 @@
 */
 
 #include "RTMFPServer.h"
-#include "RTMFP.h"
-#include "Handshake.h"
-#include "Middle.h"
-#include "PacketWriter.h"
 #include "Util.h"
 #include "Logs.h"
+#include "Poco/RandomStream.h"
+#include <openssl/evp.h>
 #include "string.h"
+#if defined(__linux__)
+	#include <sys/socket.h>
+	#include <linux/filter.h>
+	#include <errno.h>
+	#ifndef SO_ATTACH_REUSEPORT_CBPF
+		#define SO_ATTACH_REUSEPORT_CBPF 51
+	#endif
+#endif
 
 
 using namespace std;
@@ -32,216 +38,210 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-RTMFPServer::RTMFPServer(UInt8 keepAliveServer,UInt8 keepAlivePeer) : _handler(keepAliveServer,keepAlivePeer,NULL),_terminate(false),_pCirrus(NULL),_handshake(*this,_socket,_handler),_nextIdSession(0) {
+RTMFPServer::RTMFPServer(UInt8 keepAliveServer,UInt8 keepAlivePeer) : _terminate(false),_port(RTMFP_DEFAULT_PORT),_batchSize(0),_uring(false),_statelessCookies(false),_pPool(NULL),_pCryptoPool(NULL),_pDHPool(NULL),_pCirrus(NULL),_handler(keepAliveServer,keepAlivePeer,NULL) {
 #ifndef _WIN32
 //	static const char rnd_seed[] = "string to make the random number generator think it has entropy";
 //	RAND_seed(rnd_seed, sizeof(rnd_seed));
 #endif
+	init();
 }
 
 
-RTMFPServer::RTMFPServer(ClientHandler& clientHandler,UInt8 keepAliveServer,UInt8 keepAlivePeer) : _handler(keepAliveServer,keepAlivePeer,&clientHandler),_terminate(false),_pCirrus(NULL),_handshake(*this,_socket,_handler),_nextIdSession(0) {
+RTMFPServer::RTMFPServer(ClientHandler& clientHandler,UInt8 keepAliveServer,UInt8 keepAlivePeer) : _terminate(false),_port(RTMFP_DEFAULT_PORT),_batchSize(0),_uring(false),_statelessCookies(false),_pPool(NULL),_pCryptoPool(NULL),_pDHPool(NULL),_pCirrus(NULL),_handler(keepAliveServer,keepAlivePeer,&clientHandler) {
 #ifndef _WIN32
 //	static const char rnd_seed[] = "string to make the random number generator think it has entropy";
 //	RAND_seed(rnd_seed, sizeof(rnd_seed));
 #endif
+	init();
 }
 
 RTMFPServer::~RTMFPServer() {
 	stop();
 }
 
-Session* RTMFPServer::findSession(UInt32 id) {
- 
-	// Id session can't be egal to 0 (it's reserved to Handshake)
-	if(id==0) {
-		DEBUG("Handshaking");
-		return &_handshake;
-	}
-	Session* pSession = _sessions.find(id);
-	if(pSession) {
-		DEBUG("Session d'identification '%u'",id);
-		return pSession;
+void RTMFPServer::init() {
+	_handler.streams.setRelay(this);
+
+	// One certificat for all the workers, it's the identity of this server
+	memcpy(_certificat,"\x01\x0A\x41\x0E",4);
+	RandomInputStream().read((char*)&_certificat[4],64);
+	memcpy(&_certificat[68],"\x02\x15\x02\x02\x15\x05\x02\x15\x0E",9);
+
+	// Display far id flash side
+	UInt8 id[32];
+	EVP_Digest(_certificat,sizeof(_certificat),id,NULL,EVP_sha256(),NULL);
+
+	INFO("Id of this cumulus server : %s",Util::FormatHex(id,32).c_str());
+}
+
+UInt32 RTMFPServer::findSession(const UInt8* peerId) {
+	vector<RTMFPWorker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it) {
+		UInt32 id = (*it)->sessions().findId(peerId);
+		if(id!=0)
+			return id;
 	}
+	return 0;
+}
 
-	WARN("Unknown session '%u'",id);
-	return NULL;
+UInt32 RTMFPServer::findSession(const SocketAddress& address) {
+	vector<RTMFPWorker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it) {
+		UInt32 id = (*it)->sessions().findId(address);
+		if(id!=0)
+			return id;
+	}
+	return 0;
 }
 
+void RTMFPServer::relay(UInt8 shard,const string& name,UInt8 type,PacketReader& packet) {
+	if(shard<_workers.size())
+		_workers[shard]->relay(name,type,packet);
+}
 
 void RTMFPServer::start(UInt16 port,const SocketAddress* pCirrus) {
+	RTMFPServerParams params;
+	params.port = port;
+	params.pCirrus = pCirrus;
+	start(params);
+}
+
+void RTMFPServer::start(const RTMFPServerParams& params) {
 	ScopedLock<FastMutex> lock(_mutex);
-	if(_mainThread.isRunning()) {
+	if(running()) {
 		ERROR("RTMFPServer server is yet running, call stop method before");
 		return;
 	}
-	_port = port;
-	((Poco::UInt32&)_sessions.freqManage) = 2000000;
-	if(pCirrus) {
-		_pCirrus = new Cirrus(*pCirrus,_sessions);
-		((Poco::UInt32&)_sessions.freqManage) = 0; // no waiting, direct process in the middle case!
+	// workers of a previous start which have ended by themselves
+	vector<RTMFPWorker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it)
+		delete *it;
+	_workers.clear();
+
+	_port = params.port;
+	_batchSize = params.batchSize;
+	_uring = params.uring;
+	_statelessCookies = params.statelessCookies;
+	_handler.proximity = params.proximity;
+	UInt8 threads = params.threads==0 ? 1 : params.threads;
+	if(params.pCirrus && threads>1) {
+		WARN("Middle mode works with one thread only");
+		threads = 1;
+	}
+
+	// Sockets are bound in the worker order, it gives their index in the reuseport group of the kernel
+	if(!_pPool)
+		_pPool = new PacketPool(256,params.hugePages);
+	if(params.cryptoThreads>0 && !_pCryptoPool)
+		_pCryptoPool = new CryptoPool(params.cryptoThreads);
+	if(params.dhPoolDepth>0 && !_pDHPool) {
+		ScopedLock<FastMutex> lock(_dhPoolMutex);
+		_pDHPool = new DHPool(params.dhPoolDepth,params.dhThreads);
+	}
+
+	for(UInt8 i=0;i<threads;++i) {
+		_workers.push_back(new RTMFPWorker(*this,i,_certificat));
+		_workers.back()->bind();
 	}
+	if(threads>1 && params.steering)
+		attachSteering();
+
+	// the cirrus sockets of the middle sessions are watched by the reactor, no need of a fast manage
+	if(params.pCirrus)
+		_pCirrus = new Cirrus(*params.pCirrus);
+
 	_terminate = false;
-	_mainThread.start(*this);
-	
+	NOTE("RTMFP server starts on %hu port with %hu thread(s)",_port,(UInt16)threads);
+	for(it=_workers.begin();it!=_workers.end();++it)
+		(*it)->_thread.start(**it);
 }
 
 void RTMFPServer::stop() {
 	ScopedLock<FastMutex> lock(_mutex);
 	_terminate = true;
-	if(_mainThread.isRunning())
-		_mainThread.join();
+	if(!_workers.empty()) {
+		INFO("RTMFP server stopping");
+		vector<RTMFPWorker*>::const_iterator it;
+		for(it=_workers.begin();it!=_workers.end();++it)
+			(*it)->wakeUp();
+		for(it=_workers.begin();it!=_workers.end();++it) {
+			if((*it)->_thread.isRunning())
+				(*it)->_thread.join();
+		}
+		// the crypto threads stop before the deletion of the workers, which own the decodings in progress
+		// and whose the reactors can be woken up until there (the reactors are closed by the worker destructors)
+		if(_pCryptoPool) {
+			delete _pCryptoPool;
+			_pCryptoPool = NULL;
+		}
+		for(it=_workers.begin();it!=_workers.end();++it)
+			delete *it;
+		_workers.clear();
+		NOTE("RTMFP server stops");
+	}
+	if(_pDHPool) {
+		ScopedLock<FastMutex> lock(_dhPoolMutex);
+		DHPoolStats stats;
+		_pDHPool->stats(stats);
+		INFO("Diffie-Hellman pool : %u keypairs ready on %hu, %u misses on %u handshakes",stats.ready,stats.depth,stats.misses,stats.acquired);
+		delete _pDHPool;
+		_pDHPool = NULL;
+	}
+	if(_pPool) {
+		INFO("Packet pool : %u buffers allocated, %u in use at most",_pPool->capacity(),_pPool->highWater());
+		delete _pPool;
+		_pPool = NULL;
+	}
 	if(_pCirrus) {
 		delete _pCirrus;
 		_pCirrus = NULL;
 	}
 }
 
-void RTMFPServer::run() {
-	SetThreadName("RTMFPServer");
-	SocketAddress address("0.0.0.0",_port);
-	_socket.bind(address,true);
-	
-	SocketAddress sender;
-	UInt8 buff[PACKETRECV_SIZE];
-	int size = 0;
-	Timespan span(250000);
-
-	NOTE("RTMFP server starts on %hu port",_port);
-
-	while(!_terminate) {
-
-		_sessions.manage();
-
-		try {
-			if (!_socket.poll(span, Socket::SELECT_READ))
-				continue;
-			size = _socket.receiveFrom(buff,sizeof(buff),sender);
-		} catch(Exception& ex) {
-			WARN("Main socket reception : %s",ex.displayText().c_str());
-			_socket.close();
-			_socket.bind(address,true);
-			continue;
-		}
-
-		DEBUG("Sender : %s",sender.toString().c_str());
-
-		// A very small test port protocol (echo one byte)
-		if(size==1) {
-			_socket.sendTo(buff,1,sender);
-			continue;
-		}
-
-		PacketReader packet(buff,size);
-		if(packet.available()<RTMFP_MIN_PACKET_SIZE) {
-			ERROR("Invalid packet");
-			continue;
-		}
-
-		UInt32 idSession = RTMFP::Unpack(packet);
-		Session* pSession = this->findSession(idSession);
-
-		if(!pSession)
-			continue;
-
-		if(!pSession->_testDecode && Logs::GetLevel()>=Logger::PRIO_DEBUG)
-			Logs::Dump(packet,"Packet crypted:");
-		if(!pSession->decode(packet,sender)) {
-			Logs::Dump(packet,"Packet decrypted:");
-			ERROR("Decrypt error");
-			continue;
-		}
-	
-		Logs::Dump(packet,"Request:");
-
-		pSession->packetHandler(packet);
-
-	}
-
-	INFO("RTMFP server stopping");
-	
-	_sessions.clear();
-	_handshake.clear();
-	_socket.close();
-
-	NOTE("RTMFP server stops");
-}
-
-
-UInt32 RTMFPServer::createSession(UInt32 farId,const Peer& peer,const UInt8* decryptKey,const UInt8* encryptKey) {
-	while(_nextIdSession==0 || _sessions.find(_nextIdSession))
-		++_nextIdSession;
-
-	if(_pCirrus) {
-		Middle* pMiddle = new Middle(_nextIdSession,farId,peer,decryptKey,encryptKey,_socket,_handler,*_pCirrus);
-		_sessions.add(pMiddle);
-		DEBUG("500ms sleeping to wait cirrus handshaking");
-		Thread::sleep(500); // to wait the cirrus handshake
-		pMiddle->manage();
+void RTMFPServer::attachSteering() {
+#if defined(__linux__)
+	// Classic BPF program which computes the session id like RTMFP::Unpack (XOR of the 3 first 32-bit words),
+	// and returns its high byte, the worker index. Handshake packets (id 0) return an out of range index,
+	// in this case the kernel falls back on its 4-tuple hash. Offsets are relative to the UDP payload.
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,0),
+		BPF_STMT(BPF_MISC|BPF_TAX,0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,4),
+		BPF_STMT(BPF_ALU|BPF_XOR|BPF_X,0),
+		BPF_STMT(BPF_MISC|BPF_TAX,0),
+		BPF_STMT(BPF_LD|BPF_W|BPF_ABS,8),
+		BPF_STMT(BPF_ALU|BPF_XOR|BPF_X,0),
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,0,2,0),
+		BPF_STMT(BPF_ALU|BPF_RSH|BPF_K,SESSION_SHARD_SHIFT),
+		BPF_STMT(BPF_RET|BPF_A,0),
+		BPF_STMT(BPF_RET|BPF_K,0xFFFFFFFF)
+	};
+	struct sock_fprog program;
+	program.len = sizeof(code)/sizeof(code[0]);
+	program.filter = code;
+	// attached on one socket, the program is used by all the reuseport group
+	if(setsockopt(_workers[0]->_socket.impl()->sockfd(),SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,&program,sizeof(program))!=0) {
+		WARN("Session steering unavailable (error %d, %s), the packets are forwarded between workers",errno,strerror(errno));
 	} else
-		_sessions.add(new Session(_nextIdSession,farId,peer,decryptKey,encryptKey,_socket,_handler));
-
-	return _nextIdSession;
+		DEBUG("Session steering attached on the %hu sockets",(UInt16)_workers.size());
+#endif
 }
 
+bool RTMFPServer::dhPoolStats(DHPoolStats& stats) {
+	ScopedLock<FastMutex> lock(_dhPoolMutex);
+	if(!_pDHPool)
+		return false;
+	_pDHPool->stats(stats);
+	return true;
+}
 
-UInt8 RTMFPServer::p2pHandshake(const string& tag,PacketWriter& response,const SocketAddress& address,const UInt8* peerIdWanted) {
-
-	// find the flash client equivalence
-	Session* pSession = NULL;
-	Sessions::Iterator it;
-	for(it=_sessions.begin();it!=_sessions.end();++it) {
-		pSession = it->second;
-		if(memcmp(pSession->peer().address.addr(),address.addr(),address.length())==0 && pSession->peer().address.port() == address.port())
-			break;
-	}
-	if(it==_sessions.end())
-		pSession=NULL;
-
-	Session* pSessionWanted = _sessions.find(peerIdWanted);
-
-	if(_pCirrus) {
-		// Just to make working the man in the middle mode !
-
-		if(!pSession) {
-			ERROR("UDP Hole punching error : middle equivalence not found for session wanted");
-			return 0;
-		}
-
-		PacketWriter& request = ((Middle*)pSession)->handshaker();
-		request.write8(0x22);request.write8(0x21);
-		request.write8(0x0F);
-		request.writeRaw(pSessionWanted ? ((Middle*)pSessionWanted)->middlePeer().id : peerIdWanted,32);
-		request.writeRaw(tag);
-
-		((Middle*)pSession)->sendHandshakeToCirrus(0x30);
-		// no response here!
-		return 0;
-	}
-
-	
-	if(!pSessionWanted) {
-		DEBUG("UDP Hole punching : session wanted not found, must be dead");
-		return 0;
-	} else if(pSessionWanted->failed()) {
-		DEBUG("UDP Hole punching : session wanted is deleting");
-		return 0;
-	}
-	
-	/// Udp hole punching normal process
-	pSessionWanted->p2pHandshake(address,tag,pSession);
-
-	response.writeAddress(pSessionWanted->peer().address,true);
-	vector<Address>::const_iterator it2;
-	for(it2=pSessionWanted->peer().privateAddress.begin();it2!=pSessionWanted->peer().privateAddress.end();++it2) {
-		const Address& addr = *it2;
-		if(addr == address)
-			continue;
-		response.writeAddress(addr,false);
+bool RTMFPServer::running() {
+	vector<RTMFPWorker*>::const_iterator it;
+	for(it=_workers.begin();it!=_workers.end();++it) {
+		if((*it)->_thread.isRunning())
+			return true;
 	}
-	
-	return 0x71;
-
+	return false;
 }
 
 
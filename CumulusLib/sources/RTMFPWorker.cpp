@@ -0,0 +1,515 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "RTMFPWorker.h"
+#include "RTMFPServer.h"
+#include "RTMFP.h"
+#include "Middle.h"
+#include "PacketWriter.h"
+#include "Logs.h"
+#include "Poco/Format.h"
+#include "string.h"
+
+
+using namespace std;
+using namespace Poco;
+using namespace Poco::Net;
+
+
+namespace Cumulus {
+
+RTMFPWorker::Datagram::Datagram(PacketBuffer* pBuffer,int size,const SocketAddress& sender) : pBuffer(pBuffer),size(size),sender(sender) {
+}
+
+RTMFPWorker::Datagram::~Datagram() {
+	pBuffer->release();
+}
+
+RTMFPWorker::Introduction::Introduction(const string& tag,const SocketAddress& address,UInt32 idSession,UInt32 idSessionWanted) :
+	tag(tag),address(address),idSession(idSession),idSessionWanted(idSessionWanted),known(false) {
+}
+
+RTMFPWorker::Introduction::~Introduction() {
+}
+
+RTMFPWorker::Media::Media(const string& name,UInt8 type,PacketReader& packet) : name(name),type(type),data((const char*)packet.current(),packet.available()) {
+}
+
+RTMFPWorker::Media::~Media() {
+}
+
+RTMFPWorker::Decoding::Decoding(RTMFPWorker& worker,UInt32 idSession,AESEngine& aesDecrypt,PacketBuffer* pBuffer,int size,const SocketAddress& sender) :
+	idSession(idSession),pBuffer(pBuffer),size(size),sender(sender),decoded(false),_worker(worker),_aesDecrypt(aesDecrypt) {
+}
+
+RTMFPWorker::Decoding::~Decoding() {
+	pBuffer->release();
+}
+
+void RTMFPWorker::Decoding::process() {
+	PacketReader packet(pBuffer->data(),size);
+	packet.reset(4);
+	decoded = RTMFP::Decode(_aesDecrypt,packet);
+	_worker.decoded(this);
+}
+
+RTMFPWorker::RTMFPWorker(RTMFPServer& server,UInt8 index,const UInt8* certificat) : index(index),_server(server),_engine(_socket,*server._pPool),
+	_handshake(*this,_engine,server._handler,certificat,server._pDHPool,server._pCryptoPool,server._statelessCookies),_sessions(index) {
+}
+
+RTMFPWorker::~RTMFPWorker() {
+	QueueNode* pNode;
+	while((pNode=_forwarded.pop()))
+		delete pNode;
+	while((pNode=_introductions.pop()))
+		delete pNode;
+	while((pNode=_media.pop()))
+		delete pNode;
+	// the decodings are owned by _decodings, and the key exchanges by the handshake
+	while(_decoded.pop());
+	while(_exchanged.pop());
+	map<UInt32,deque<Decoding*> >::const_iterator it;
+	for(it=_decodings.begin();it!=_decodings.end();++it) {
+		deque<Decoding*>::const_iterator itD;
+		for(itD=it->second.begin();itD!=it->second.end();++itD)
+			delete *itD;
+	}
+}
+
+Session* RTMFPWorker::findSession(UInt32 id) {
+ 
+	// Id session can't be egal to 0 (it's reserved to Handshake)
+	if(id==0) {
+		DEBUG("Handshaking");
+		return &_handshake;
+	}
+	Session* pSession = _sessions.find(id);
+	if(pSession) {
+		DEBUG("Session d'identification '%u'",id);
+		return pSession;
+	}
+
+	WARN("Unknown session '%u'",id);
+	return NULL;
+}
+
+void RTMFPWorker::forward(PacketBuffer* pBuffer,int size,const SocketAddress& sender) {
+	_forwarded.push(new Datagram(pBuffer,size,sender));
+	// wake up the worker once until it reads its queue
+	if(++_wakeups==1)
+		_reactor.wakeUp();
+}
+
+void RTMFPWorker::receiveForwarded() {
+	QueueNode* pNode;
+	while((pNode=_forwarded.pop())) {
+		Datagram* pDatagram = (Datagram*)pNode;
+		packetHandler(pDatagram->pBuffer->data(),pDatagram->size,pDatagram->sender,-1,pDatagram->pBuffer);
+		delete pDatagram;
+	}
+}
+
+void RTMFPWorker::decoded(Decoding* pDecoding) {
+	_decoded.push(pDecoding);
+	if(++_wakeups==1)
+		_reactor.wakeUp();
+}
+
+void RTMFPWorker::dispatchDecoded() {
+	QueueNode* pNode;
+	while((pNode=_decoded.pop())) {
+		Decoding* pDecoding = (Decoding*)pNode;
+		// it's the first packet of its session, the one in decryption
+		map<UInt32,deque<Decoding*> >::iterator it = _decodings.find(pDecoding->idSession);
+		if(it==_decodings.end() || it->second.front()!=pDecoding) {
+			ERROR("Decoding of session %u unexpected",pDecoding->idSession);
+			continue;
+		}
+		deque<Decoding*>& decodings = it->second;
+		decodings.pop_front();
+		// the session is alive until here, Session::decrypting
+		Session& session = pDecoding->idSession==0 ? _handshake : *_sessions.find(pDecoding->idSession);
+		session.decrypting = false;
+		PacketReader packet(pDecoding->pBuffer->data(),pDecoding->size);
+		packet.reset(6);
+		dispatch(pDecoding->idSession,packet,pDecoding->decoded,pDecoding->sender);
+		delete pDecoding;
+		if(decodings.empty())
+			_decodings.erase(it);
+		else
+			decrypt(session,decodings);
+	}
+}
+
+void RTMFPWorker::decrypt(Session& session,deque<Decoding*>& decodings) {
+	session.decrypting = true;
+	_server._pCryptoPool->push(decodings.front());
+}
+
+void RTMFPWorker::waitDecoded() {
+	while(!_decodings.empty()) {
+		_reactor.wait();
+		if(!_reactor.woken())
+			continue;
+		_wakeups = 0;
+		QueueNode* pNode;
+		while((pNode=_decoded.pop())) {
+			// the packets of the session waiting their decryption are forgotten
+			map<UInt32,deque<Decoding*> >::iterator it = _decodings.find(((Decoding*)pNode)->idSession);
+			if(it==_decodings.end())
+				continue;
+			deque<Decoding*>::const_iterator itD;
+			for(itD=it->second.begin();itD!=it->second.end();++itD)
+				delete *itD;
+			_decodings.erase(it);
+		}
+	}
+}
+
+void RTMFPWorker::keyExchanged(KeyExchange* pKeyExchange) {
+	_exchanged.push(pKeyExchange);
+	if(++_wakeups==1)
+		_reactor.wakeUp();
+}
+
+void RTMFPWorker::dispatchExchanged() {
+	QueueNode* pNode;
+	while((pNode=_exchanged.pop()))
+		_handshake.keyExchanged((KeyExchange*)pNode);
+}
+
+void RTMFPWorker::relay(const string& name,UInt8 type,PacketReader& packet) {
+	_media.push(new Media(name,type,packet));
+	if(++_wakeups==1)
+		_reactor.wakeUp();
+}
+
+void RTMFPWorker::dispatchMedia() {
+	QueueNode* pNode;
+	while((pNode=_media.pop())) {
+		Media* pMedia = (Media*)pNode;
+		PacketReader packet((const UInt8*)pMedia->data.c_str(),pMedia->data.size());
+		_server._handler.streams.relayed(pMedia->name,pMedia->type,packet,index);
+		delete pMedia;
+	}
+}
+
+void RTMFPWorker::post(Introduction* pIntroduction) {
+	_introductions.push(pIntroduction);
+	if(++_wakeups==1)
+		_reactor.wakeUp();
+}
+
+void RTMFPWorker::dispatchIntroductions() {
+	QueueNode* pNode;
+	while((pNode=_introductions.pop()))
+		introduce((Introduction*)pNode);
+}
+
+void RTMFPWorker::introduce(Introduction* pIntroduction) {
+	// the requester gives its private addresses
+	if(pIntroduction->idSession!=0) {
+		if(SESSION_SHARD(pIntroduction->idSession)!=index) {
+			RTMFPWorker* pWorker = _server.worker(pIntroduction->idSession);
+			if(pWorker)
+				pWorker->post(pIntroduction);
+			else
+				delete pIntroduction;
+			return;
+		}
+		Session* pSession = _sessions.find(pIntroduction->idSession);
+		if(pSession) {
+			pIntroduction->privateAddress = pSession->peer().privateAddress;
+			pIntroduction->known = true;
+		}
+		pIntroduction->idSession = 0;
+	}
+
+	// the wanted peer is introduced, and the requester gets its addresses
+	if(SESSION_SHARD(pIntroduction->idSessionWanted)!=index) {
+		RTMFPWorker* pWorker = _server.worker(pIntroduction->idSessionWanted);
+		if(pWorker)
+			pWorker->post(pIntroduction);
+		else
+			delete pIntroduction;
+		return;
+	}
+	Session* pSessionWanted = _sessions.find(pIntroduction->idSessionWanted);
+	if(!pSessionWanted) {
+		DEBUG("UDP Hole punching : session wanted not found, must be dead");
+	} else if(pSessionWanted->failed()) {
+		DEBUG("UDP Hole punching : session wanted is deleting");
+	} else {
+		pSessionWanted->p2pHandshake(pIntroduction->address,pIntroduction->tag,pIntroduction->known ? &pIntroduction->privateAddress : NULL);
+		_handshake.p2pHandshaked(pIntroduction->tag,pIntroduction->address,pSessionWanted->peer());
+	}
+	delete pIntroduction;
+}
+
+PacketBuffer* RTMFPWorker::keep(int slot,PacketBuffer* pBuffer) {
+	if(!pBuffer)
+		return _engine.take(slot);
+	pBuffer->retain();
+	return pBuffer;
+}
+
+void RTMFPWorker::bind() {
+	_reactor.open(_sessions.freqManage);
+	open();
+}
+
+void RTMFPWorker::open() {
+	// the reuse flag sets SO_REUSEPORT too, in this way all the workers listen the same port
+	_socket.bind(SocketAddress("0.0.0.0",_server._port),true);
+	_engine.open(_server._batchSize,_server._uring);
+	// tag 0 is the main socket (or its ring), the other tags are the ids of the middle sessions
+#if defined(__linux__)
+	if(_engine.ring()) {
+		_reactor.add(_engine.ringFd(),0);
+		return;
+	}
+#endif
+	_reactor.add(_socket,0);
+}
+
+void RTMFPWorker::receive() {
+	int count = 0;
+	try {
+		count = _engine.receive();
+	} catch(Exception& ex) {
+		WARN("Main socket reception : %s",ex.displayText().c_str());
+		_engine.close();
+		_socket.close();
+		open();
+		return;
+	}
+	for(int i=0;i<count;++i)
+		packetHandler(_engine.packet(i),_engine.size(i),_engine.sender(i),i);
+}
+
+void RTMFPWorker::run() {
+	SetThreadName(index==0 ? "RTMFPServer" : format("RTMFPServer %hu",(UInt16)index).c_str());
+
+	while(!_server._terminate) {
+
+		int count = _reactor.wait();
+
+		if(_reactor.woken()) {
+			_wakeups = 0;
+			receiveForwarded();
+			dispatchDecoded();
+			dispatchExchanged();
+			dispatchIntroductions();
+			dispatchMedia();
+		}
+
+		for(int i=0;i<count;++i) {
+			UInt32 tag = _reactor.tag(i);
+			if(tag==0) {
+				receive();
+				continue;
+			}
+			// cirrus socket of a middle session
+			Session* pSession = _sessions.find(tag);
+			if(pSession)
+				pSession->manage();
+		}
+
+		// send in one time all the responses of this loop
+		if(_reactor.timer()) {
+			_sessions.manage();
+			_handshake.manage();
+		}
+		_engine.flush();
+	}
+
+	waitDecoded();
+	_sessions.clear();
+	_handshake.clear();
+	_engine.close();
+	_socket.close();
+	// the reactor stays open until the deletion of the worker: the other workers and the crypto threads
+	// can wake it up until the server has joined them
+}
+
+Session* RTMFPWorker::route(PacketReader& packet,const SocketAddress& sender,int slot,PacketBuffer* pBuffer,UInt32& idSession) {
+
+	DEBUG("Sender : %s",sender.toString().c_str());
+
+	// A very small test port protocol (echo one byte)
+	if(packet.available()==1) {
+		_engine.send(packet.current(),1,sender);
+		return NULL;
+	}
+
+	if(packet.available()<RTMFP_MIN_PACKET_SIZE) {
+		ERROR("Invalid packet");
+		return NULL;
+	}
+
+	int size = packet.available();
+	idSession = RTMFP::Unpack(packet);
+
+	if(idSession!=0 && SESSION_SHARD(idSession)!=index) {
+		// The kernel has given this packet to the wrong socket, the session is owned by an other worker
+		RTMFPWorker* pWorker = _server.worker(idSession);
+		if(pWorker)
+			pWorker->forward(keep(slot,pBuffer),size,sender); // the buffer is given, without copy
+		else
+			WARN("Unknown session '%u'",idSession);
+		return NULL;
+	}
+
+	Session* pSession = this->findSession(idSession);
+
+	if(!pSession)
+		return NULL;
+
+	if(!pSession->_testDecode && Logs::GetLevel()>=Logger::PRIO_DEBUG)
+		Logs::Dump(packet,"Packet crypted:");
+
+	return pSession;
+}
+
+void RTMFPWorker::packetHandler(UInt8* data,int size,const SocketAddress& sender,int slot,PacketBuffer* pBuffer) {
+	PacketReader packet(data,size);
+	UInt32 idSession;
+	Session* pSession = route(packet,sender,slot,pBuffer,idSession);
+	if(!pSession)
+		return;
+
+	if(_server._pCryptoPool) {
+		// Pipeline mode, the decryption is done by the crypto pool and the dispatch waits the previous packets of the session
+		if(pSession->died())
+			return;
+		deque<Decoding*>& decodings = _decodings[idSession];
+		decodings.push_back(new Decoding(*this,idSession,pSession->aesDecrypt(),keep(slot,pBuffer),size,sender));
+		// the engine of the session decrypts one packet at a time (it isn't thread-safe), the others wait in the arrival order
+		if(decodings.size()==1)
+			decrypt(*pSession,decodings);
+		return;
+	}
+
+	// the session is owned by this worker thread
+	dispatch(idSession,packet,pSession->decode(packet),sender);
+}
+
+void RTMFPWorker::dispatch(UInt32 idSession,PacketReader& packet,bool valid,const SocketAddress& sender) {
+	if(!valid) {
+		Logs::Dump(packet,"Packet decrypted:");
+		ERROR("Decrypt error");
+		return;
+	}
+
+	Logs::Dump(packet,"Request:");
+
+	// No lock, the session is handled only by this worker: the sessions of the other workers are reached by queues (hole punching, streams),
+	// and the groups, the streams and the client handler have their own locks.
+
+	// the session can have died during its decryption in pipeline mode
+	Session* pSession = idSession==0 ? &_handshake : _sessions.find(idSession);
+	if(!pSession)
+		return;
+	pSession->_testDecode = true;
+	if(idSession==0)
+		_handshake.setAddress(sender);
+	else
+		_sessions.setAddress(*pSession,sender);
+	pSession->packetHandler(packet);
+}
+
+
+UInt32 RTMFPWorker::createSession(UInt32 farId,const Peer& peer,const UInt8* decryptKey,const UInt8* encryptKey) {
+	UInt32 id = _sessions.nextId();
+	if(id==0) {
+		ERROR("Sessions table of the worker %hu is full, session creation refused",(UInt16)index);
+		return 0;
+	}
+
+	if(_server._pCirrus) {
+		Middle* pMiddle = new Middle(id,farId,peer,decryptKey,encryptKey,_engine,_server._handler,*_server._pCirrus);
+		_sessions.add(pMiddle);
+		_reactor.add(pMiddle->cirrusSocket(),id);
+		DEBUG("500ms sleeping to wait cirrus handshaking");
+		Thread::sleep(500); // to wait the cirrus handshake
+		pMiddle->manage();
+	} else
+		_sessions.add(new Session(id,farId,peer,decryptKey,encryptKey,_engine,_server._handler));
+
+	return id;
+}
+
+
+UInt8 RTMFPWorker::p2pHandshake(const string& tag,PacketWriter& response,const SocketAddress& address,const UInt8* peerIdWanted) {
+
+	if(_server._pCirrus) {
+		// Just to make working the man in the middle mode ! (one worker only)
+		Session* pSession = _sessions.find(address);
+		Session* pSessionWanted = _sessions.find(peerIdWanted);
+
+		if(!pSession) {
+			ERROR("UDP Hole punching error : middle equivalence not found for session wanted");
+			return 0;
+		}
+
+		PacketWriter& request = ((Middle*)pSession)->handshaker();
+		request.write8(0x22);request.write8(0x21);
+		request.write8(0x0F);
+		request.writeRaw(pSessionWanted ? ((Middle*)pSessionWanted)->middlePeer().id : peerIdWanted,32);
+		request.writeRaw(tag);
+
+		((Middle*)pSession)->sendHandshakeToCirrus(0x30);
+		// no response here!
+		return 0;
+	}
+
+	// find the flash client equivalence, the sessions can be owned by other workers
+	UInt32 idSession = _server.findSession(address);
+	UInt32 idSessionWanted = _server.findSession(peerIdWanted);
+
+	if(idSessionWanted==0) {
+		DEBUG("UDP Hole punching : session wanted not found, must be dead");
+		return 0;
+	}
+
+	if(SESSION_SHARD(idSessionWanted)!=index || (idSession!=0 && SESSION_SHARD(idSession)!=index)) {
+		// the worker of the wanted session will respond
+		introduce(new Introduction(tag,address,idSession,idSessionWanted));
+		return 0;
+	}
+
+	Session* pSession = idSession==0 ? NULL : _sessions.find(idSession);
+	Session* pSessionWanted = _sessions.find(idSessionWanted);
+	if(!pSessionWanted) {
+		DEBUG("UDP Hole punching : session wanted not found, must be dead");
+		return 0;
+	} else if(pSessionWanted->failed()) {
+		DEBUG("UDP Hole punching : session wanted is deleting");
+		return 0;
+	}
+	
+	/// Udp hole punching normal process
+	pSessionWanted->p2pHandshake(address,tag,pSession ? &pSession->peer().privateAddress : NULL);
+
+	Handshake::WriteAddresses(response,pSessionWanted->peer(),address);
+	
+	return 0x71;
+
+}
+
+
+} // namespace Cumulus
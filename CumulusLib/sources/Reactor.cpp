@@ -0,0 +1,223 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "Reactor.h"
+#include "Logs.h"
+#include "Poco/Format.h"
+#include "Poco/Net/NetException.h"
+#include "string.h"
+#if defined(__linux__)
+	#include <sys/epoll.h>
+	#include <sys/timerfd.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+// epoll data of the internal descriptors, out of the range of the socket tags
+#define REACTOR_TIMER	0x100000000ULL
+#define REACTOR_WAKEUP	0x200000000ULL
+
+using namespace std;
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace Cumulus {
+
+#if defined(__linux__)
+
+Reactor::Reactor() : _period(0),_timer(false),_woken(false),_epoll(-1),_timerFd(-1),_eventFd(-1),_pEvents(NULL) {
+	_tags.reserve(REACTOR_MAX_EVENTS);
+}
+
+void Reactor::open(UInt32 period) {
+	close();
+	_period = period;
+	_epoll = epoll_create(REACTOR_MAX_EVENTS);
+	_timerFd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+	_eventFd = eventfd(0,EFD_NONBLOCK);
+	if(_epoll<0 || _timerFd<0 || _eventFd<0) {
+		int error = errno;
+		close();
+		throw NetException(format("Reactor creation error %d : %s",error,string(strerror(error))));
+	}
+	_pEvents = new epoll_event[REACTOR_MAX_EVENTS];
+
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = period/1000000;
+	spec.it_interval.tv_nsec = (period%1000000)*1000;
+	spec.it_value = spec.it_interval;
+	timerfd_settime(_timerFd,0,&spec,NULL);
+
+	struct epoll_event event;
+	memset(&event,0,sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = REACTOR_TIMER;
+	epoll_ctl(_epoll,EPOLL_CTL_ADD,_timerFd,&event);
+	event.data.u64 = REACTOR_WAKEUP;
+	epoll_ctl(_epoll,EPOLL_CTL_ADD,_eventFd,&event);
+}
+
+void Reactor::close() {
+	if(_epoll>=0)
+		::close(_epoll);
+	if(_timerFd>=0)
+		::close(_timerFd);
+	if(_eventFd>=0)
+		::close(_eventFd);
+	_epoll=_timerFd=_eventFd=-1;
+	if(_pEvents) {
+		delete [] _pEvents;
+		_pEvents = NULL;
+	}
+}
+
+void Reactor::add(const Socket& socket,UInt32 tag) {
+	add(socket.impl()->sockfd(),tag);
+}
+
+void Reactor::add(int fd,UInt32 tag) {
+	struct epoll_event event;
+	memset(&event,0,sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = tag;
+	if(epoll_ctl(_epoll,EPOLL_CTL_ADD,fd,&event)!=0)
+		ERROR("Reactor add error %d : %s",errno,strerror(errno));
+}
+
+void Reactor::wakeUp() {
+	if(_eventFd<0)
+		return;
+	UInt64 value = 1;
+	if(::write(_eventFd,&value,sizeof(value))<0 && errno!=EAGAIN)
+		ERROR("Reactor wake up error %d : %s",errno,strerror(errno));
+}
+
+int Reactor::wait() {
+	_timer = _woken = false;
+	_tags.clear();
+	int count = epoll_wait(_epoll,_pEvents,REACTOR_MAX_EVENTS,-1);
+	if(count<0) {
+		if(errno!=EINTR)
+			ERROR("Reactor wait error %d : %s",errno,strerror(errno));
+		return 0;
+	}
+	UInt64 value;
+	for(int i=0;i<count;++i) {
+		UInt64 data = _pEvents[i].data.u64;
+		if(data==REACTOR_TIMER) {
+			_timer = ::read(_timerFd,&value,sizeof(value))>0;
+		} else if(data==REACTOR_WAKEUP) {
+			_woken = ::read(_eventFd,&value,sizeof(value))>0;
+		} else
+			_tags.push_back((UInt32)data);
+	}
+	return _tags.size();
+}
+
+#else
+
+Reactor::Reactor() : _period(0),_timer(false),_woken(false),_pWakeSocket(NULL) {
+}
+
+void Reactor::open(UInt32 period) {
+	close();
+	_period = period;
+	_nextTick.update();
+	_nextTick += period;
+	_pWakeSocket = new DatagramSocket();
+	_pWakeSocket->bind(SocketAddress("127.0.0.1",0));
+}
+
+void Reactor::close() {
+	if(_pWakeSocket) {
+		delete _pWakeSocket;
+		_pWakeSocket = NULL;
+	}
+	_sockets.clear();
+	_socketTags.clear();
+}
+
+void Reactor::add(const Socket& socket,UInt32 tag) {
+	_sockets.push_back(socket);
+	_socketTags.push_back(tag);
+}
+
+void Reactor::wakeUp() {
+	if(!_pWakeSocket)
+		return;
+	try {
+		_pWakeSocket->sendTo(&_period,1,_pWakeSocket->address());
+	} catch(Exception& ex) {
+		ERROR("Reactor wake up error : %s",ex.displayText().c_str());
+	}
+}
+
+int Reactor::wait() {
+	_timer = _woken = false;
+	_tags.clear();
+
+	Socket::SocketList readList,writeList,exceptList;
+	readList.push_back(*_pWakeSocket);
+	for(UInt32 i=0;i<_sockets.size();++i) {
+		// forget the sockets closed
+		if(_sockets[i].impl()->sockfd()==POCO_INVALID_SOCKET) {
+			_sockets.erase(_sockets.begin()+i);
+			_socketTags.erase(_socketTags.begin()+i);
+			--i;
+			continue;
+		}
+		readList.push_back(_sockets[i]);
+	}
+
+	Timestamp now;
+	Timespan timeout(_nextTick>now ? _nextTick-now : 0);
+	Socket::select(readList,writeList,exceptList,timeout);
+
+	if(_nextTick.isElapsed(0)) {
+		_timer = true;
+		_nextTick.update();
+		_nextTick += _period;
+	}
+
+	Socket::SocketList::const_iterator it;
+	for(it=readList.begin();it!=readList.end();++it) {
+		if(*it == *_pWakeSocket) {
+			_woken = true;
+			UInt8 buff[PACKETRECV_SIZE];
+			while(_pWakeSocket->available()>0)
+				_pWakeSocket->receiveBytes(buff,sizeof(buff));
+			continue;
+		}
+		for(UInt32 i=0;i<_sockets.size();++i) {
+			if(*it == _sockets[i]) {
+				_tags.push_back(_socketTags[i]);
+				break;
+			}
+		}
+	}
+	return _tags.size();
+}
+
+#endif
+
+Reactor::~Reactor() {
+	close();
+}
+
+
+} // namespace Cumulus
@@ -0,0 +1,93 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "ResponseCache.h"
+#include "Util.h"
+#include <string.h>
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+ResponseKey::ResponseKey() : _size(0),_hash(0) {
+	memset(_value,0,sizeof(_value));
+}
+
+ResponseKey::ResponseKey(const UInt8* value,UInt8 size) : _size(size>RESPONSE_KEY_SIZE ? RESPONSE_KEY_SIZE : size) {
+	memset(_value,0,sizeof(_value));
+	memcpy(_value,value,_size);
+	_hash = Util::Hash(_value,_size);
+}
+
+UInt32 ResponseKey::hash() const {
+	return _hash;
+}
+
+bool ResponseKey::operator==(const ResponseKey& other) const {
+	return _hash==other._hash && _size==other._size && memcmp(_value,other._value,_size)==0;
+}
+
+
+CachedResponse::CachedResponse() : id(0),created(0) {
+}
+
+CachedResponse::~CachedResponse() {
+}
+
+
+ResponseCache::ResponseCache(UInt32 capacity) : _responses(capacity==0 ? 1 : capacity),_oldest(0),_count(0) {
+}
+
+ResponseCache::~ResponseCache() {
+}
+
+void ResponseCache::add(const UInt8* key,UInt8 size,UInt8 id,const UInt8* content,int contentSize,Timestamp::TimeVal now) {
+	ResponseKey responseKey(key,size);
+	if(_index.find(responseKey))
+		return;
+	if(_count==_responses.size())
+		pop(); // replaces the oldest
+	CachedResponse& response = _responses[(_oldest+_count)%_responses.size()];
+	++_count;
+	response.key = responseKey;
+	response.id = id;
+	response.content.assign((const char*)content,contentSize);
+	response.created = now;
+	_index.set(responseKey,&response);
+}
+
+void ResponseCache::pop() {
+	CachedResponse& response = _responses[_oldest];
+	_index.erase(response.key);
+	response.content.clear();
+	_oldest = (_oldest+1)%_responses.size();
+	--_count;
+}
+
+void ResponseCache::expire(Timestamp::TimeVal now) {
+	while(_count>0 && (now-_responses[_oldest].created)>=RESPONSE_TIMEOUT)
+		pop();
+}
+
+void ResponseCache::clear() {
+	while(_count>0)
+		pop();
+}
+
+
+} // namespace Cumulus
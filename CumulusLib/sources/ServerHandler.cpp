@@ -23,55 +23,62 @@ using namespace Poco;
 namespace Cumulus {
 
 ServerHandler::ServerHandler(UInt8 keepAliveServer,UInt8 keepAlivePeer,ClientHandler* pClientHandler) :
-		keepAliveServer(keepAliveServer<5 ? 5000 : keepAliveServer*1000),
+		proximity(false),
 		keepAlivePeer(keepAlivePeer<5 ? 5000 : keepAlivePeer*1000),
+		keepAliveServer(keepAliveServer<5 ? 5000 : keepAliveServer*1000),
 		_pClientHandler(pClientHandler) {
 	
 }
 
 
 ServerHandler::~ServerHandler() {
-	// delete groups
-	list<Group*>::const_iterator it;
-	for(it=_groups.begin();it!=_groups.end();++it)
+	// delete groups (normally they have been deleted with their last peer)
+	vector<Group*> groups;
+	_groups.values(groups);
+	vector<Group*>::const_iterator it;
+	for(it=groups.begin();it!=groups.end();++it)
 		delete (*it);
 	_groups.clear();
 }
 
+Group* ServerHandler::findGroup(const vector<UInt8>& id) const {
+	return _groups.find(id);
+}
+
 Group& ServerHandler::group(const vector<UInt8>& id) {
-	Group* pGroup;
-	list<Group*>::iterator it=((ServerHandler*)this)->_groups.begin();
-	while(it!=_groups.end()) {
-		pGroup=*it;
-		if(pGroup->operator==(id))
-			return *pGroup;
-		// delete a possible empty group in same time
-		if(pGroup->empty()) {
-			delete pGroup;
-			((ServerHandler*)this)->_groups.erase(it++);
-			continue;
-		}
-		++it;
-	}
-	pGroup = new Group(id);
-	((ServerHandler*)this)->_groups.push_back(pGroup);
+	GroupKey key(id);
+	Group* pGroup = _groups.find(key);
+	if(pGroup)
+		return *pGroup;
+	pGroup = new Group(id,*this);
+	_groups.set(key,pGroup);
 	return *pGroup;
 }
 
+void ServerHandler::deleteGroup(Group& group) {
+	_groups.erase(group.id());
+	delete &group;
+}
+
 bool ServerHandler::connection(Peer& peer) {
-	if(_pClientHandler)
-		return _pClientHandler->onConnection(peer);
-	return true;
+	if(!_pClientHandler)
+		return true;
+	ScopedLock<FastMutex> lock(_clientMutex);
+	return _pClientHandler->onConnection(peer);
 }
 
 void ServerHandler::failed(Peer& peer,const string& msg) {
-	if(_pClientHandler)
-		_pClientHandler->onFailed(peer,msg);
+	if(!_pClientHandler)
+		return;
+	ScopedLock<FastMutex> lock(_clientMutex);
+	_pClientHandler->onFailed(peer,msg);
 }
 
 void ServerHandler::disconnection(Peer& peer) {
-	if(_pClientHandler)
-		_pClientHandler->onDisconnection(peer);
+	if(!_pClientHandler)
+		return;
+	ScopedLock<FastMutex> lock(_clientMutex);
+	_pClientHandler->onDisconnection(peer);
 }
 
 
@@ -36,10 +36,10 @@ Session::Session(UInt32 id,
 				 const Peer& peer,
 				 const UInt8* decryptKey,
 				 const UInt8* encryptKey,
-				 DatagramSocket& socket,
+				 DatagramEngine& engine,
 				 ServerHandler& serverHandler) : 
-		_id(id),_farId(farId),_socket(socket),_testDecode(false),
-		_aesDecrypt(decryptKey,AESEngine::DECRYPT),_aesEncrypt(encryptKey,AESEngine::ENCRYPT),_serverHandler(serverHandler),_peer(peer),_flowNull(_peer,*this,_serverHandler),_died(false),_failed(false),_timesFailed(0),_timeSent(0),_timesKeepalive(0),_writer(_buffer,sizeof(_buffer)) {
+		_testDecode(false),decrypting(false),_serverHandler(serverHandler),_farId(farId),_timeSent(0),_failed(false),_timesFailed(0),_timesKeepalive(0),_flowNull(_peer,*this,_serverHandler),_id(id),
+		_engine(engine),_aesDecrypt(decryptKey,AESEngine::DECRYPT),_aesEncrypt(encryptKey,AESEngine::ENCRYPT),_pBuffer(engine.pool().acquire()),_writer(_pBuffer->data(),PACKETSEND_SIZE),_died(false),_peer(peer) {
 	_writer.next(11);
 	_writer.limit(RTMFP_MAX_PACKET_LENGTH); // set normal limit
 }
@@ -54,16 +54,20 @@ Session::~Session() {
 	for(it=_flows.begin();it!=_flows.end();++it)
 		delete it->second;
 	_flows.clear();
+	_pBuffer->release();
 }
 
-bool Session::decode(PacketReader& packet,const SocketAddress& sender) {
-	((SocketAddress&)_peer.address) = sender;
+bool Session::decode(PacketReader& packet) {
 	bool result = RTMFP::Decode(_aesDecrypt,packet);
 	if(result)
 		_testDecode = true;
 	return result;
 }
 
+void Session::setAddress(const SocketAddress& address) {
+	((SocketAddress&)_peer.address) = address;
+}
+
 void Session::kill() {
 	if(_died)
 		return;
@@ -73,6 +77,7 @@ void Session::kill() {
 	}
 	_died=true;
 	_failed=true;
+	manageSoon(); // to be deleted
 }
 
 void Session::manage() {
@@ -115,6 +120,28 @@ void Session::manage() {
 	flush();
 }
 
+Timestamp::TimeDiff Session::nextManage() const {
+	// failed, it sends the fail message on every tick until its death
+	if(_failed)
+		return 0;
+	// raise the repeat triggers on every tick
+	map<UInt8,Flow*>::const_iterator it;
+	for(it=_flows.begin();it!=_flows.end();++it) {
+		if(it->second->repeating())
+			return 0;
+	}
+	// then keepalive on every tick after 2 mn without client message
+	Timestamp::TimeDiff elapsed = _recvTimestamp.elapsed();
+	if(elapsed>=120000000)
+		return 0;
+	return 120000000-elapsed;
+}
+
+void Session::manageSoon() {
+	if(wheel())
+		wheel()->advance(*this,1);
+}
+
 void Session::keepAlive() {
 	DEBUG("Keepalive server");
 	if(_timesKeepalive==10) {
@@ -129,6 +156,7 @@ void Session::setFailed(const string& msg) {
 	if(_failed)
 		return;
 	_failed=true;
+	manageSoon();
 	if(_peer.state!=Client::NONE)
 		_serverHandler.failed(_peer,msg);
 	// Set flows in consumed state
@@ -146,6 +174,7 @@ void Session::fail() {
 	if(!_failed) {
 		WARN("Here flag failed should be put (with setFailed method), fail() method just allows the fail packet sending");
 		_failed=true;
+		manageSoon();
 	}
 	++_timesFailed;
 	PacketWriter& writer = this->writer(); 
@@ -157,28 +186,28 @@ void Session::fail() {
 		kill();
 }
 
-void Session::p2pHandshake(const SocketAddress& address,const std::string& tag,Session* pSession) {
+void Session::p2pHandshake(const SocketAddress& address,const std::string& tag,const vector<Address>* pPrivateAddress) {
 
 	DEBUG("Peer newcomer address send to peer '%u' connected",id());
 	
 	Address const* pAddress = NULL;
 	UInt16 size = 0x37 + (address.host().family() == IPAddress::IPv6 ? 16 : 4);
 
-	if(pSession) {
+	if(pPrivateAddress) {
 		map<string,UInt8>::iterator it =	_p2pHandshakeAttemps.find(tag);
 		if(it==_p2pHandshakeAttemps.end()) {
 			it = _p2pHandshakeAttemps.insert(pair<string,UInt8>(tag,0)).first;
 			// If two clients are on the same lan, starts with private address
-			if(memcmp(address.addr(),peer().address.addr(),address.length())==0 && pSession->peer().privateAddress.size()>0)
+			if(memcmp(address.addr(),peer().address.addr(),address.length())==0 && pPrivateAddress->size()>0)
 				it->second=1;
 		}
 		
 		if(it->second>0) {
-			pAddress = &pSession->peer().privateAddress[it->second-1];
+			pAddress = &(*pPrivateAddress)[it->second-1];
 			size +=  pAddress->host.size();
 		}
 		++it->second;
-		if(it->second > pSession->peer().privateAddress.size())
+		if(it->second > pPrivateAddress->size())
 			it->second=0;
 	}
 	
@@ -224,25 +253,11 @@ void Session::flush(UInt8 flags) {
 		Logs::Dump(packet,6,"Response:");
 
 		if(flags&SYMETRIC_ENCODING)
-			RTMFP::Encode(packet);
+			RTMFP::Finalize(packet,_farId);
 		else
-			RTMFP::Encode(_aesEncrypt,packet);
+			RTMFP::Finalize(_aesEncrypt,packet,_farId);
 
-		RTMFP::Pack(packet,_farId);
-
-		try {
-			// TODO remake? without retry (but flow)
-			bool retry=false;
-			while(_socket.sendTo(packet.begin(),packet.length(),_peer.address)!=packet.length()) {
-				if(retry) {
-					ERROR("Socket send error on session '%u' : all data were not sent",_id);
-					break;
-				}
-				retry = true;
-			}
-		} catch(Exception& ex) {
-			 CRITIC("Socket send error on session '%u' : %s",_id,ex.displayText().c_str());
-		}
+		_engine.send(packet.begin(),packet.length(),_peer.address);
 		
 		if(!timeEcho)
 			packet.clip(-2);
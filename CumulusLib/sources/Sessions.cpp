@@ -17,6 +17,8 @@
 
 #include "Sessions.h"
 #include "Logs.h"
+#include "Util.h"
+#include <cstring>
 
 using namespace std;
 using namespace Poco;
@@ -24,7 +26,50 @@ using namespace Poco::Net;
 
 namespace Cumulus {
 
-Sessions::Sessions() : freqManage(2000000)/* 2 sec by default*/ {
+AddressKey::AddressKey() : _size(0),_port(0),_hash(0) {
+	memset(_host,0,sizeof(_host));
+}
+
+AddressKey::AddressKey(const SocketAddress& address) : _size(address.host().length()),_port(address.port()),_hash(0) {
+	memset(_host,0,sizeof(_host));
+	if(_size>sizeof(_host))
+		_size = sizeof(_host);
+	memcpy(_host,address.host().addr(),_size);
+	UInt8 data[sizeof(_host)+2];
+	memcpy(data,_host,_size);
+	data[_size] = _port>>8;
+	data[_size+1] = _port&0xFF;
+	_hash = Util::Hash(data,_size+2);
+}
+
+UInt32 AddressKey::hash() const {
+	return _hash;
+}
+
+bool AddressKey::operator==(const AddressKey& other) const {
+	return _hash==other._hash && _port==other._port && _size==other._size && memcmp(_host,other._host,_size)==0;
+}
+
+PeerIdKey::PeerIdKey() : _hash(0) {
+	memset(_id,0,sizeof(_id));
+}
+
+PeerIdKey::PeerIdKey(const UInt8* id) {
+	memcpy(_id,id,sizeof(_id));
+	// the peer id is the digest of a certificate chosen by the peer, so it's hashed with the secret key
+	_hash = Util::Hash(_id,sizeof(_id));
+}
+
+UInt32 PeerIdKey::hash() const {
+	return _hash;
+}
+
+bool PeerIdKey::operator==(const PeerIdKey& other) const {
+	return _hash==other._hash && memcmp(_id,other._id,sizeof(_id))==0;
+}
+
+
+Sessions::Sessions(UInt8 shard) : freqManage(2000000)/* 2 sec by default*/,_shard(shard),_slots(1),_freeHead(0),_freeTail(0) {
 }
 
 Sessions::~Sessions() {
@@ -33,57 +78,136 @@ Sessions::~Sessions() {
 
 void Sessions::clear() {
 	// delete sessions
-	map<UInt32,Session*>::const_iterator it;
+	Iterator it;
 	for(it=_sessions.begin();it!=_sessions.end();++it) {
 		// to prevent client of session death
-		it->second->fail("sessions are deleting");
-		delete it->second;
+		(*it)->fail("sessions are deleting");
+		delete *it;
 	}
 	_sessions.clear();
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		_addresses.clear();
+		_peerIds.clear();
+	}
+	_slots.assign(1,Slot());
+	_freeHead = _freeTail = 0;
+}
+
+UInt32 Sessions::nextId() const {
+	UInt32 slot = _freeHead;
+	if(slot==0) {
+		if(_slots.size()>SESSION_SLOT_MASK)
+			return 0;
+		slot = _slots.size();
+	}
+	UInt8 generation = slot<_slots.size() ? _slots[slot].generation : 0;
+	return ((UInt32)_shard<<SESSION_SHARD_SHIFT) | ((UInt32)generation<<SESSION_SLOT_BITS) | slot;
 }
 
 Session* Sessions::add(Session* pSession) {
-	Session* pSessionOther = find(pSession->id());
-	if(pSessionOther && pSessionOther != pSession) {
-		ERROR("A session exists already with the same id '%u'",pSession->id());
+	if(pSession->id()!=nextId()) {
+		ERROR("Session id '%u' is not the one reserved by the sessions table",pSession->id());
 		return NULL;
 	}
+	UInt32 slot = pSession->id()&SESSION_SLOT_MASK;
+	if(slot==_slots.size())
+		_slots.push_back(Slot());
+	else {
+		_freeHead = _slots[slot].index;
+		if(_freeHead==0)
+			_freeTail=0;
+	}
+	Slot& entry = _slots[slot];
+	entry.id = pSession->id();
+	entry.pSession = pSession;
+	entry.index = _sessions.size();
+	_sessions.push_back(pSession);
+	{
+		// the last session wins when several sessions come from the same address
+		ScopedLock<FastMutex> lock(_mutex);
+		_addresses.set(pSession->peer().address,pSession);
+		_peerIds.set(pSession->peer().id,pSession);
+	}
+
 	NOTE("Session %u created",pSession->id());
-	return _sessions[pSession->id()] = pSession;
+	schedule(*pSession);
+	return pSession;
 }
 
-Session* Sessions::find(const Poco::UInt8* peerId) const {
-	Iterator it;
-	for(it=_sessions.begin();it!=_sessions.end();++it) {
-		if(it->second->peer() == peerId)
-			return it->second;
-	}
-	return NULL;
+void Sessions::setAddress(Session& session,const SocketAddress& address) {
+	AddressKey key(address);
+	AddressKey oldKey(session.peer().address);
+	if(key==oldKey)
+		return;
+	ScopedLock<FastMutex> lock(_mutex);
+	if(_addresses.find(oldKey)==&session)
+		_addresses.erase(oldKey);
+	session.setAddress(address);
+	_addresses.set(key,&session);
 }
 
-Session* Sessions::find(UInt32 id) const {
-	Iterator it = _sessions.find(id);
-	if(it==_sessions.end())
-		return NULL;
-	return it->second;
+UInt32 Sessions::findId(const UInt8* peerId) const {
+	ScopedLock<FastMutex> lock(_mutex);
+	Session* pSession = _peerIds.find(peerId);
+	return pSession ? pSession->id() : 0;
 }
 
-void Sessions::manage() {
-	if(!_timeLastManage.isElapsed(freqManage))
-		return;
+UInt32 Sessions::findId(const SocketAddress& address) const {
+	ScopedLock<FastMutex> lock(_mutex);
+	Session* pSession = _addresses.find(address);
+	return pSession ? pSession->id() : 0;
+}
 
-	_timeLastManage.update();
+void Sessions::remove(Session& session) {
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		AddressKey key(session.peer().address);
+		if(_addresses.find(key)==&session)
+			_addresses.erase(key);
+		PeerIdKey peerId(session.peer().id);
+		if(_peerIds.find(peerId)==&session)
+			_peerIds.erase(peerId);
+	}
 
-	map<UInt32,Session*>::iterator it= _sessions.begin();
-	while(it!=end()) {
-		it->second->manage();
-		if(it->second->died()) {
-			NOTE("Session %u died",it->second->id());
-			delete it->second;
-			_sessions.erase(it++);
+	UInt32 slot = session.id()&SESSION_SLOT_MASK;
+	Slot& entry = _slots[slot];
+	// the last session takes the place in the dense array
+	Session* pLast = _sessions.back();
+	_sessions[entry.index] = pLast;
+	_slots[pLast->id()&SESSION_SLOT_MASK].index = entry.index;
+	_sessions.pop_back();
+	// release the slot, the oldest released slots are reused first
+	entry.id = 0;
+	entry.pSession = NULL;
+	entry.index = 0;
+	entry.generation = (entry.generation+1)&SESSION_GENERATION_MASK;
+	if(_freeTail==0)
+		_freeHead = slot;
+	else
+		_slots[_freeTail].index = slot;
+	_freeTail = slot;
+}
+
+void Sessions::schedule(Session& session) {
+	// round up to be sure that the deadline is reached on expiration
+	Timestamp::TimeDiff delay = session.nextManage();
+	_wheel.schedule(session,(UInt32)((delay+freqManage-1)/freqManage));
+}
+
+void Sessions::manage() {
+	_wheel.tick();
+	Timer* pTimer;
+	while((pTimer=_wheel.pop())) {
+		Session& session = static_cast<Session&>(*pTimer);
+		session.manage();
+		if(session.died() && !session.decrypting) {
+			NOTE("Session %u died",session.id());
+			remove(session);
+			delete &session;
 			continue;
 		}
-		++it;
+		schedule(session);
 	}
 }
 
@@ -17,13 +17,14 @@
 
 #include "Streams.h"
 #include "Logs.h"
+#include "string.h"
 
 using namespace std;
 using namespace Poco;
 
 namespace Cumulus {
 
-Streams::Streams() : _nextId(0) {
+Streams::Streams() : _pRelay(NULL),_nextId(0) {
 	
 }
 
@@ -34,12 +35,17 @@ Streams::~Streams() {
 		delete it->second;
 }
 
+void Streams::setRelay(StreamRelay* pRelay) {
+	ScopedLock<FastMutex> lock(_mutex);
+	_pRelay = pRelay;
+}
+
 Streams::SubscriptionIt Streams::subscriptionIt(const string& name) {
 	// Return a suscription iterator and create the subscrition if it doesn't exist
 	SubscriptionIt it = _subscriptions.find(name);
 	if(it != _subscriptions.end())
 		return it;
-	return _subscriptions.insert(pair<string,Subscription*>(name,new Subscription())).first;
+	return _subscriptions.insert(pair<string,Subscription*>(name,new Subscription(name))).first;
 }
 
 void Streams::cleanSubscription(SubscriptionIt& it) {
@@ -49,6 +55,7 @@ void Streams::cleanSubscription(SubscriptionIt& it) {
 }
 
 bool Streams::publish(UInt32 id,const string& name) {
+	ScopedLock<FastMutex> lock(_mutex);
 	SubscriptionIt it = subscriptionIt(name);
 	if(it->second->idPublisher!=0)
 		return false; // has already a publisher
@@ -57,6 +64,7 @@ bool Streams::publish(UInt32 id,const string& name) {
 }
 
 void Streams::unpublish(UInt32 id,const string& name) {
+	ScopedLock<FastMutex> lock(_mutex);
 	SubscriptionIt it = subscriptionIt(name);
 	if(it->second->idPublisher!=id) {
 		WARN("Unpublish '%s' operation with a '%d' id different than its publisher '%d' id",name.c_str(),id,it->second->idPublisher);
@@ -67,16 +75,19 @@ void Streams::unpublish(UInt32 id,const string& name) {
 }
 
 void Streams::subscribe(const string& name,Listener& listener) {
+	ScopedLock<FastMutex> lock(_mutex);
 	subscriptionIt(name)->second->add(listener);
 }
 
 void Streams::unsubscribe(const string& name,Listener& listener) {
+	ScopedLock<FastMutex> lock(_mutex);
 	SubscriptionIt it = subscriptionIt(name);
 	it->second->remove(listener);
 	cleanSubscription(it);
 }
 
 Subscription* Streams::subscription(UInt32 id) {
+	ScopedLock<FastMutex> lock(_mutex);
 	SubscriptionIt it;
 	for(it=_subscriptions.begin();it!=_subscriptions.end();++it) {
 		if(it->second->idPublisher==id)
@@ -85,12 +96,63 @@ Subscription* Streams::subscription(UInt32 id) {
 	return NULL;
 }
 
+bool Streams::push(Subscription& subscription,UInt32 idPublisher,UInt8 type,PacketReader& packet,UInt8 shard) {
+	// the listeners of this worker can be used out of the lock, only this thread can remove them
+	vector<Listener*> listeners;
+	UInt32 shards[8];
+	memset(shards,0,sizeof(shards));
+	StreamRelay* pRelay;
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		if(subscription.idPublisher!=idPublisher)
+			return false;
+		subscription.listeners(shard,listeners,shards);
+		pRelay = _pRelay;
+	}
+	int pos = packet.position();
+	if(pRelay) {
+		for(UInt16 i=0;i<256;++i) {
+			if(shards[i>>5]&(1U<<(i&0x1F))) {
+				pRelay->relay((UInt8)i,subscription.name,type,packet);
+				packet.reset(pos);
+			}
+		}
+	}
+	vector<Listener*>::const_iterator it;
+	for(it=listeners.begin();it!=listeners.end();++it) {
+		(*it)->pushPacket(type,packet);
+		packet.reset(pos);
+	}
+	return true;
+}
+
+void Streams::relayed(const string& name,UInt8 type,PacketReader& packet,UInt8 shard) {
+	vector<Listener*> listeners;
+	UInt32 shards[8];
+	memset(shards,0,sizeof(shards));
+	{
+		ScopedLock<FastMutex> lock(_mutex);
+		map<string,Subscription*>::const_iterator it = _subscriptions.find(name);
+		if(it==_subscriptions.end())
+			return;
+		it->second->listeners(shard,listeners,shards);
+	}
+	int pos = packet.position();
+	vector<Listener*>::const_iterator it;
+	for(it=listeners.begin();it!=listeners.end();++it) {
+		(*it)->pushPacket(type,packet);
+		packet.reset(pos);
+	}
+}
+
 UInt32 Streams::create() {
+	ScopedLock<FastMutex> lock(_mutex);
 	while(!_streams.insert(++_nextId).second);
 	return _nextId;
 }
 
 void Streams::destroy(UInt32 id) {
+	ScopedLock<FastMutex> lock(_mutex);
 	_streams.erase(id);
 	SubscriptionIt it;
 	for(it=_subscriptions.begin();it!=_subscriptions.end();++it) {
@@ -99,7 +161,6 @@ void Streams::destroy(UInt32 id) {
 			cleanSubscription(it);
 		}
 	}
-	
 }
 
 
@@ -22,7 +22,7 @@ using namespace std;
 
 namespace Cumulus {
 
-Subscription::Subscription():idPublisher(0) {
+Subscription::Subscription(const string& name) : name(name),idPublisher(0) {
 	
 }
 
@@ -30,21 +30,13 @@ Subscription::Subscription():idPublisher(0) {
 Subscription::~Subscription() {
 }
 
-void Subscription::pushAudioPacket(PacketReader& packet) {
+void Subscription::listeners(Poco::UInt8 shard,vector<Listener*>& listeners,Poco::UInt32* shards) const {
 	list<Listener*>::const_iterator it;
-	int pos = packet.position();
 	for(it=_listeners.begin();it!=_listeners.end();++it) {
-		(*it)->pushAudioPacket(packet);
-		packet.reset(pos);
-	}
-}
-
-void Subscription::pushVideoPacket(PacketReader& packet) {
-	list<Listener*>::const_iterator it;
-	int pos = packet.position();
-	for(it=_listeners.begin();it!=_listeners.end();++it) {
-		(*it)->pushVideoPacket(packet);
-		packet.reset(pos);
+		if((*it)->shard==shard)
+			listeners.push_back(*it);
+		else
+			shards[(*it)->shard>>5] |= 1U<<((*it)->shard&0x1F);
 	}
 }
 
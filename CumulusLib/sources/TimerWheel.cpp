@@ -0,0 +1,128 @@
+/* 
+	Copyright 2010 OpenRTMFP
+ 
+	This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License received along this program for more
+	details (or else see http://www.gnu.org/licenses/).
+
+	This file is a part of Cumulus.
+*/
+
+#include "TimerWheel.h"
+
+using namespace std;
+using namespace Poco;
+
+namespace Cumulus {
+
+Timer::Timer() : _pPrev(this),_pNext(this),_expiry(0),_pWheel(NULL) {
+}
+
+Timer::~Timer() {
+	unlink();
+}
+
+void Timer::link(Timer& head) {
+	_pPrev = head._pPrev;
+	_pNext = &head;
+	head._pPrev->_pNext = this;
+	head._pPrev = this;
+}
+
+void Timer::unlink() {
+	_pPrev->_pNext = _pNext;
+	_pNext->_pPrev = _pPrev;
+	_pPrev = _pNext = this;
+}
+
+
+TimerWheel::TimerWheel() : _now(0) {
+}
+
+TimerWheel::~TimerWheel() {
+	// unschedule the remaining timers, they can be deleted after the wheel
+	for(UInt8 level=0;level<TIMERWHEEL_LEVELS;++level) {
+		for(UInt8 slot=0;slot<TIMERWHEEL_SLOTS;++slot) {
+			Timer& head = _slots[level][slot];
+			while(head.scheduled())
+				cancel(*head._pNext);
+		}
+	}
+	while(_expired.scheduled())
+		cancel(*_expired._pNext);
+}
+
+void TimerWheel::schedule(Timer& timer,UInt32 ticks) {
+	timer.unlink();
+	if(ticks==0)
+		ticks=1;
+	// beyond the last level, the timer expires at the limit of the wheel
+	if(ticks>=(1U<<(TIMERWHEEL_BITS*TIMERWHEEL_LEVELS)))
+		ticks = (1U<<(TIMERWHEEL_BITS*TIMERWHEEL_LEVELS))-1;
+	timer._expiry = _now+ticks;
+	timer._pWheel = this;
+	insert(timer);
+}
+
+void TimerWheel::advance(Timer& timer,UInt32 ticks) {
+	if(ticks==0)
+		ticks=1;
+	if(timer.scheduled() && timer._pWheel==this && (timer._expiry-_now)<=ticks)
+		return;
+	schedule(timer,ticks);
+}
+
+void TimerWheel::cancel(Timer& timer) {
+	timer.unlink();
+	timer._pWheel = NULL;
+}
+
+void TimerWheel::insert(Timer& timer) {
+	UInt32 delta = timer._expiry-_now;
+	UInt8 level=0;
+	while(level<(TIMERWHEEL_LEVELS-1) && delta>=(1U<<(TIMERWHEEL_BITS*(level+1))))
+		++level;
+	timer.link(_slots[level][(timer._expiry>>(TIMERWHEEL_BITS*level))&(TIMERWHEEL_SLOTS-1)]);
+}
+
+void TimerWheel::cascade(UInt8 level) {
+	// the timers of this slot expire in the next slots of the lower levels
+	Timer& head = _slots[level][(_now>>(TIMERWHEEL_BITS*level))&(TIMERWHEEL_SLOTS-1)];
+	while(head.scheduled()) {
+		Timer& timer = *head._pNext;
+		timer.unlink();
+		insert(timer);
+	}
+}
+
+void TimerWheel::tick() {
+	++_now;
+	UInt8 level=1;
+	while(level<TIMERWHEEL_LEVELS && ((_now>>(TIMERWHEEL_BITS*(level-1)))&(TIMERWHEEL_SLOTS-1))==0)
+		cascade(level++);
+
+	Timer& head = _slots[0][_now&(TIMERWHEEL_SLOTS-1)];
+	while(head.scheduled()) {
+		Timer& timer = *head._pNext;
+		timer.unlink();
+		timer.link(_expired);
+	}
+}
+
+Timer* TimerWheel::pop() {
+	if(!_expired.scheduled())
+		return NULL;
+	Timer* pTimer = _expired._pNext;
+	cancel(*pTimer);
+	return pTimer;
+}
+
+
+} // namespace Cumulus
@@ -24,7 +24,7 @@ using namespace Poco;
 
 namespace Cumulus {
 
-Trigger::Trigger() : _time(0),_cycle(-1),_running(false) {
+Trigger::Trigger() : _timeout(1500000),_cycle(-1),_time(0),_running(false) {
 	
 }
 
@@ -38,9 +38,10 @@ void Trigger::reset() {
 	_cycle=-1;
 }
 
-void Trigger::start() {
+void Trigger::start(Timestamp::TimeDiff timeout) {
 	if(_running)
 		return;
+	_timeout = timeout>1500000 ? timeout : 1500000;
 	reset();
 	_running=true;
 }
@@ -48,8 +49,8 @@ void Trigger::start() {
 bool Trigger::raise() {
 	if(!_running)
 		return false;
-	// Wait at least 1.5 sec before to begin the repeat cycle
-	if(_time==0 && !_timeInit.isElapsed(1500000))
+	// Wait at least 1.5 sec (or the retransmission timeout) before to begin the repeat cycle
+	if(_time==0 && !_timeInit.isElapsed(_timeout))
 		return false;
 	++_time;
 	if(_time>=_cycle) {
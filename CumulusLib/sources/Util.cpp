@@ -19,6 +19,7 @@
 #include "Poco/URI.h"
 #include "Poco/FileStream.h"
 #include "Poco/HexBinaryEncoder.h"
+#include "Poco/RandomStream.h"
 #include <sstream>
 
 using namespace std;
@@ -39,6 +40,50 @@ string Util::FormatHex(const UInt8* data,unsigned size) {
 	return oss.str();
 }
 
+class HashKey {
+public:
+	HashKey() {
+		RandomInputStream().read((char*)k,sizeof(k));
+	}
+	UInt64 k[2];
+};
+static HashKey s_hashKey;
+
+#define SIP_ROTL(X,B) (((X)<<(B))|((X)>>(64-(B))))
+#define SIP_ROUND \
+	v0 += v1; v1 = SIP_ROTL(v1,13); v1 ^= v0; v0 = SIP_ROTL(v0,32); \
+	v2 += v3; v3 = SIP_ROTL(v3,16); v3 ^= v2; \
+	v0 += v3; v3 = SIP_ROTL(v3,21); v3 ^= v0; \
+	v2 += v1; v1 = SIP_ROTL(v1,17); v1 ^= v2; v2 = SIP_ROTL(v2,32);
+
+UInt32 Util::Hash(const UInt8* data,unsigned size) {
+	UInt64 v0 = 0x736f6d6570736575ULL^s_hashKey.k[0];
+	UInt64 v1 = 0x646f72616e646f6dULL^s_hashKey.k[1];
+	UInt64 v2 = 0x6c7967656e657261ULL^s_hashKey.k[0];
+	UInt64 v3 = 0x7465646279746573ULL^s_hashKey.k[1];
+	const UInt8* end = data+(size&~7);
+	UInt64 m;
+	for(;data<end;data+=8) {
+		m = 0;
+		for(int i=7;i>=0;--i)
+			m = (m<<8)|data[i];
+		v3 ^= m;
+		SIP_ROUND SIP_ROUND
+		v0 ^= m;
+	}
+	// last bytes, and the size in the high byte
+	m = (UInt64)size<<56;
+	for(int i=(size&7)-1;i>=0;--i)
+		m |= (UInt64)data[i]<<(8*i);
+	v3 ^= m;
+	SIP_ROUND SIP_ROUND
+	v0 ^= m;
+	v2 ^= 0xFF;
+	SIP_ROUND SIP_ROUND SIP_ROUND SIP_ROUND
+	m = v0^v1^v2^v3;
+	return (UInt32)(m^(m>>32));
+}
+
 UInt8 Util::Get7BitValueSize(UInt32 value) {
 	if(value>=0x200000)
 		return 4;
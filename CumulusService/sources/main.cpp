@@ -21,6 +21,7 @@
 #include "Poco/File.h"
 #include "Poco/Format.h"
 #include "Poco/FileStream.h"
+#include "Poco/Mutex.h"
 #include "Poco/DateTimeFormatter.h"
 #include "Poco/Util/HelpFormatter.h"
 #include "Poco/Util/ServerApplication.h"
@@ -121,12 +122,14 @@ protected:
 	}
 
 	void dumpHandler(const char* data,int size) {
+		ScopedLock<FastMutex> lock(_logMutex);
 		cout.write(data,size);
 		_logStream.write(data,size);
 		manageLogFile();
 	}
 
 	void logHandler(Thread::TID threadId,const std::string& threadName,Priority priority,const char *filePath,long line, const char *text) {
+		ScopedLock<FastMutex> lock(_logMutex);
 		printf("%s  %s[%ld] %s\n",g_logPriorities[priority-1],Path(filePath).getBaseName().c_str(),line,text);
 		_logStream << DateTimeFormatter::format(LocalDateTime(),"%d/%m %H:%M:%S.%c  ")
 				<< g_logPriorities[priority-1] << '\t' << threadName << '(' << threadId << ")\t"
@@ -194,7 +197,20 @@ protected:
 		else {
 			/// Cumulus Service
 			RTMFPServer server(*this,config().getInt("keepAliveServer",15),config().getInt("keepAlivePeer",10));
-			server.start(config().getInt("port", RTMFP_DEFAULT_PORT),_pCirrus);
+			RTMFPServerParams params;
+			params.port = config().getInt("port", RTMFP_DEFAULT_PORT);
+			params.pCirrus = _pCirrus;
+			params.batchSize = config().getInt("batchSize",0);
+			params.uring = config().getBool("uring",false);
+			params.threads = config().getInt("threads",1);
+			params.steering = config().getBool("steering",true);
+			params.hugePages = config().getBool("hugePages",false);
+			params.cryptoThreads = config().getInt("cryptoThreads",0);
+			params.proximity = config().getBool("proximity",false);
+			params.dhPoolDepth = config().getInt("dhPoolDepth",0);
+			params.dhThreads = config().getInt("dhThreads",1);
+			params.statelessCookies = config().getBool("statelessCookies",false);
+			server.start(params);
 			// wait for CTRL-C or kill
 			waitForTerminationRequest();
 			// Stop the HTTPServer
@@ -209,6 +225,7 @@ private:
 	Auth			_auth;
 	File			 _logFile;
 	FileOutputStream _logStream;
+	FastMutex		 _logMutex; // the RTMFP workers log from several threads
 	map<string, set<const Client*> > _clientFamilies;	
 };
 